@@ -1,4 +1,9 @@
 #include "tage.h"
+#include "ooo_cpu.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
 
 // Get index for base table (T0)
 std::size_t tage::get_base_index(champsim::address ip)
@@ -9,8 +14,9 @@ std::size_t tage::get_base_index(champsim::address ip)
 // Get index for tagged tables using compressed history
 std::size_t tage::get_tag_index(champsim::address ip, std::size_t table_idx)
 {
-  std::size_t length = history_lengths[table_idx];
-  uint64_t compressed_hist = get_compressed_history(length, TABLE_BITS);
+  // A history no longer than the index is not hashed in
+  const folded_history& folded = folded_histories[table_idx];
+  uint64_t compressed_hist = folded.length > folded.width ? folded.value : 0;
   std::size_t pc_part = (ip.to<uint64_t>() >> 2) & ((1ULL << TABLE_BITS) - 1);
   
   return (pc_part ^ compressed_hist) & (TAGGED_TABLE_SIZE - 1);
@@ -20,40 +26,12 @@ std::size_t tage::get_tag_index(champsim::address ip, std::size_t table_idx)
 uint64_t tage::get_partial_tag(champsim::address ip, std::size_t table_idx)
 {
   uint64_t pc_part = (ip.to<uint64_t>() >> (2 + TABLE_BITS)) & ((1ULL << TAG_BITS) - 1);
-  std::size_t length = history_lengths[table_idx];
-  uint64_t hist_part = 0;
-  
-  for (std::size_t i = 0; i < TAG_BITS && i < length; i++) {
-    if (global_history[i]) {
-      hist_part ^= (1ULL << i);
-    }
-  }
+  std::size_t length = std::min(history_lengths[table_idx], TAG_BITS);
+  uint64_t hist_part = recent_history & ((1ULL << length) - 1);
   
   return (pc_part ^ hist_part) & ((1ULL << TAG_BITS) - 1);
 }
 
-// Calculate compressed history using folding
-uint64_t tage::get_compressed_history(std::size_t history_length, std::size_t width)
-{
-  if (history_length <= width)
-    return 0;
-    
-  uint64_t compressed = 0;
-  std::size_t pieces = (history_length + width - 1) / width;
-  
-  for (std::size_t p = 0; p < pieces; p++) {
-    uint64_t piece = 0;
-    for (std::size_t i = 0; i < width && (p * width + i) < history_length; i++) {
-      if ((p * width + i) < MAX_HISTORY_LENGTH && global_history[p * width + i]) {
-        piece |= (1ULL << i);
-      }
-    }
-    compressed ^= piece;
-  }
-  
-  return compressed & ((1ULL << width) - 1);
-}
-
 // ===== Misprediction Pattern Cache (MPC) Implementation =====
 
 // Get MPC index using branch PC
@@ -148,11 +126,72 @@ void tage::update_mpc(champsim::address ip, bool taken, bool was_correct)
   }
 }
 
+// ===== Confidence estimation =====
+
+// Strength of a counter, from its distance to the midpoint: 0 (weak) for the two middle values,
+// 2 (saturated) for both ends, 1 in between. 2-bit base counters are only weak or saturated.
+// For MPC overrides the counter is the entry's pattern_confidence: the MPC only overrides from 5
+// of 7 up, so those predictions are intermediate (5, 6) or saturated (7).
+// The strength only picks the class (source x strength); whether a class is HIGH, MEDIUM or LOW
+// is decided by its measured misprediction rate in classify_confidence()
+template <std::size_t WIDTH>
+std::size_t tage::get_counter_strength(const champsim::msl::fwcounter<WIDTH>& counter)
+{
+  long distance = std::labs(2 * static_cast<long>(counter.value()) - static_cast<long>(counter.maximum));
+  if (distance >= static_cast<long>(counter.maximum))
+    return 2;
+  return distance <= 1 ? 0 : 1;
+}
+
+tage::confidence_level tage::classify_confidence(std::size_t conf_class) const
+{
+  const auto& stats = confidence_classes[conf_class];
+  if (stats.predictions < CONF_MIN_SAMPLES)
+    return confidence_level::MEDIUM;
+  
+  uint64_t scaled_misses = static_cast<uint64_t>(stats.mispredictions) * 1024;
+  if (scaled_misses <= static_cast<uint64_t>(CONF_HIGH_MAX_MISS_RATE) * stats.predictions)
+    return confidence_level::HIGH;
+  if (scaled_misses >= static_cast<uint64_t>(CONF_LOW_MIN_MISS_RATE) * stats.predictions)
+    return confidence_level::LOW;
+  return confidence_level::MEDIUM;
+}
+
+// Measures the outcome of the last prediction in its class and in its confidence level
+void tage::update_confidence(bool taken)
+{
+  bool mispredicted = (last_prediction != taken);
+  auto& stats = confidence_classes[confidence_class];
+  
+  stats.predictions++;
+  if (mispredicted)
+    stats.mispredictions++;
+  if (stats.predictions >= CONF_MAX_SAMPLES) {
+    stats.predictions /= 2;
+    stats.mispredictions /= 2;
+  }
+  
+  level_predictions[static_cast<std::size_t>(last_confidence)]++;
+  if (mispredicted)
+    level_mispredictions[static_cast<std::size_t>(last_confidence)]++;
+}
+
+void tage::print_confidence_stats() const
+{
+  static const char* const level_names[] = {"high", "medium", "low"};
+  
+  std::cout << "{\"predictor\":\"tage\",\"confidence\":{";
+  for (std::size_t i = 0; i < level_predictions.size(); i++) {
+    std::cout << (i > 0 ? "," : "") << "\"" << level_names[i] << "\":{\"predictions\":" << level_predictions[i]
+              << ",\"mispredictions\":" << level_mispredictions[i] << "}";
+  }
+  std::cout << "}}" << std::endl;
+}
+
 // Make a branch prediction
 bool tage::predict_branch(champsim::address ip)
 {
-  // Initialize predictor on first call
-  static bool initialized = false;
+  // Initialize predictor on first call, per instance: every core has its own
   if (!initialized) {
     init();
     initialized = true;
@@ -163,10 +202,12 @@ bool tage::predict_branch(champsim::address ip)
   has_found_lmb = false;
   mpc_hit = false;
   used_mpc = false;
-  
+
   // Get base table prediction
   base_index = get_base_index(ip);
   bool prediction = base_table[base_index].value() >= (base_table[base_index].maximum / 2);
+  std::size_t provider_source = 0;
+  std::size_t provider_strength = get_counter_strength(base_table[base_index]);
   
   // Check tagged tables from longest to shortest history
   for (int i = NUM_TAGGED_TABLES - 1; i >= 0; i--) {
@@ -186,6 +227,8 @@ bool tage::predict_branch(champsim::address ip)
             entry.useful_counter.value() == 0)) {
         prediction = entry.pred_counter.value() >= (entry.pred_counter.maximum / 2);
         used_tagged_table = true;
+        provider_source = (static_cast<std::size_t>(i) < CONF_SHORT_HISTORY_TABLES) ? 1 : 2;
+        provider_strength = get_counter_strength(entry.pred_counter);
         break;
       }
     }
@@ -194,6 +237,18 @@ bool tage::predict_branch(champsim::address ip)
   // Check MPC for problematic branches
   mpc_index = get_mpc_index(ip);
   prediction = check_mpc_override(ip, prediction);
+  if (used_mpc) {
+    provider_source = 3;
+    provider_strength = get_counter_strength(mpc_table[mpc_index].pattern_confidence);
+  }
+  
+  confidence_class = provider_source * CONF_NUM_STRENGTHS + provider_strength;
+  last_confidence = classify_confidence(confidence_class);
+  last_prediction = prediction;
+  
+  // Confident predictions are published to the core's prefetchers (see inc/branch_hints.h)
+  if (last_confidence == confidence_level::HIGH)
+    get_branch_hint_ring(intern_->cpu).publish({ip.to<uint64_t>(), prediction});
   
   return prediction;
 }
@@ -203,6 +258,8 @@ void tage::last_branch_result(champsim::address ip, champsim::address branch_tar
 {
   bool was_correct = false;
   
+  update_confidence(taken);
+  
   // Update TAGE tables
   if (has_found_lmb) {
     auto& entry = tagged_tables[tag_table_pos][longest_index];
@@ -251,6 +308,5 @@ void tage::last_branch_result(champsim::address ip, champsim::address branch_tar
   }
   
   // Update global history
-  global_history <<= 1;
-  global_history[0] = taken;
+  push_history(taken);
 }
\ No newline at end of file
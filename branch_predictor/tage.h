@@ -2,11 +2,19 @@
 #define BRANCH_TAGE_H
 
 #include <array>
+#include <bit>
 #include <bitset>
 #include <vector>
 #include <cmath>
 #include "modules.h"
 #include "msl/fwcounter.h"
+#include "branch_hints.h"
+
+// Confidence report (predictions and mispredictions per level), printed as JSON when the predictor
+// is destroyed. Off by default, compile with -DTAGE_CONFIDENCE_STATS=1 to enable it
+#ifndef TAGE_CONFIDENCE_STATS
+#define TAGE_CONFIDENCE_STATS 0
+#endif
 
 struct tage : champsim::modules::branch_predictor {
   //  TAGE parameters 
@@ -15,6 +23,7 @@ struct tage : champsim::modules::branch_predictor {
   static constexpr std::size_t TABLE_BITS = 12;         // 4K entries per tagged table  
   static constexpr std::size_t TAG_BITS = 14;           // 14-bit tags
   static constexpr std::size_t MAX_HISTORY_LENGTH = 400;
+  static constexpr std::size_t HISTORY_BUFFER_SIZE = std::bit_ceil(MAX_HISTORY_LENGTH);
   
   // Derived constants
   static constexpr std::size_t BASE_TABLE_SIZE = 1 << BASE_BITS;
@@ -43,6 +52,31 @@ struct tage : champsim::modules::branch_predictor {
   
   std::array<mpc_entry, MPC_SIZE> mpc_table{};
   
+  // ===== Confidence estimation =====
+  // Each prediction falls in a class (provider kind x counter strength). The misprediction rate
+  // measured per class decides its confidence level, so the levels stay calibrated as the
+  // predictor warms up and the program changes phase
+  
+  enum class confidence_level { HIGH = 0, MEDIUM = 1, LOW = 2 };
+  
+  static constexpr std::size_t CONF_NUM_SOURCES = 4;       // Base, short-history tagged, long-history tagged, MPC
+  static constexpr std::size_t CONF_NUM_STRENGTHS = 3;     // Weak, intermediate, saturated counter
+  static constexpr std::size_t CONF_NUM_CLASSES = CONF_NUM_SOURCES * CONF_NUM_STRENGTHS;
+  static constexpr std::size_t CONF_SHORT_HISTORY_TABLES = 3;
+  static constexpr uint32_t CONF_MIN_SAMPLES = 64;         // Classes with fewer predictions are MEDIUM
+  static constexpr uint32_t CONF_MAX_SAMPLES = 4096;       // Counts are halved past this, to follow phases
+  static constexpr uint32_t CONF_HIGH_MAX_MISS_RATE = 20;  // Per 1024 predictions, ~2%
+  static constexpr uint32_t CONF_LOW_MIN_MISS_RATE = 150;  // Per 1024 predictions, ~15%
+  
+  struct confidence_class_stats {
+    uint32_t predictions = 0;
+    uint32_t mispredictions = 0;
+  };
+  
+  std::array<confidence_class_stats, CONF_NUM_CLASSES> confidence_classes{};
+  std::array<uint64_t, 3> level_predictions{};            // Whole run, per confidence_level
+  std::array<uint64_t, 3> level_mispredictions{};
+  
   // Table entry structure
   struct tag_entry {
     champsim::msl::fwcounter<COUNTER_BITS_TAGGED> pred_counter{};
@@ -54,13 +88,54 @@ struct tage : champsim::modules::branch_predictor {
   std::array<champsim::msl::fwcounter<COUNTER_BITS_BASE>, BASE_TABLE_SIZE> base_table{};
   std::vector<std::vector<tag_entry>> tagged_tables;
   
-  // Global history register
-  std::bitset<MAX_HISTORY_LENGTH> global_history{};
+  // Global history register: circular buffer, a new outcome moves the head back by one
+  // so inserting is O(1) whatever MAX_HISTORY_LENGTH is. Position 0 is the most recent outcome
+  std::bitset<HISTORY_BUFFER_SIZE> global_history{};
+  std::size_t history_head = 0;
+  
+  // Folded history of one tagged table: history bit j is XORed into bit j % width. It is updated
+  // with each outcome (rotate, add the new outcome, remove the one leaving the history), so
+  // predictions never read the history and cost the same whatever the history lengths are
+  struct folded_history {
+    uint64_t value = 0;
+    std::size_t length = 0;
+    std::size_t width = 0;
+    std::size_t outpoint = 0; // Bit the outcome leaving the history was folded into
+    
+    void init(std::size_t history_length, std::size_t folded_width)
+    {
+      length = history_length;
+      width = folded_width;
+      outpoint = history_length % folded_width;
+    }
+    void update(bool taken, bool leaving)
+    {
+      value = (value << 1) | static_cast<uint64_t>(taken);
+      value ^= static_cast<uint64_t>(leaving) << outpoint;
+      value ^= value >> width;
+      value &= (1ULL << width) - 1;
+    }
+  };
+  
+  std::array<folded_history, NUM_TAGGED_TABLES> folded_histories{};
+  uint64_t recent_history = 0; // Most recent outcomes, newest in bit 0, for the partial tags
+  static_assert(TAG_BITS < 64, "The partial tag history must fit in recent_history");
+  
+  bool get_history_bit(std::size_t pos) const { return global_history[(history_head + pos) & (HISTORY_BUFFER_SIZE - 1)]; }
+  void push_history(bool taken)
+  {
+    for (auto& folded : folded_histories)
+      folded.update(taken, get_history_bit(folded.length - 1));
+    recent_history = (recent_history << 1) | static_cast<uint64_t>(taken);
+    history_head = (history_head - 1) & (HISTORY_BUFFER_SIZE - 1);
+    global_history[history_head] = taken;
+  }
   
   // History lengths for each tagged table - tuned for benchmark mix
   std::array<std::size_t, NUM_TAGGED_TABLES> history_lengths{};
   
   // Prediction state tracking
+  bool initialized = false;
   bool used_tagged_table = false;
   bool has_found_lmb = false;
   std::size_t base_index = 0;
@@ -73,9 +148,19 @@ struct tage : champsim::modules::branch_predictor {
   bool mpc_hit = false;
   bool used_mpc = false;
   
+  // Confidence state of the last prediction
+  std::size_t confidence_class = 0;
+  confidence_level last_confidence = confidence_level::MEDIUM;
+  bool last_prediction = false;
+  
   // Constructor
   using branch_predictor::branch_predictor;
   
+#if TAGE_CONFIDENCE_STATS
+  // ChampSim has no final stats hook for branch predictors: the confidence report is printed on teardown
+  ~tage() { print_confidence_stats(); }
+#endif
+  
   void init() {
     // History lengths
     // Shorter histories for loops, longer for complex control flow
@@ -86,6 +171,9 @@ struct tage : champsim::modules::branch_predictor {
     history_lengths[4] = 160;
     history_lengths[5] = 270;
     history_lengths[6] = 380;
+    for (std::size_t i = 0; i < NUM_TAGGED_TABLES; i++) {
+      folded_histories[i].init(history_lengths[i], TABLE_BITS);
+    }
     
     // Initialize tagged tables
     tagged_tables.resize(NUM_TAGGED_TABLES);
@@ -103,13 +191,22 @@ struct tage : champsim::modules::branch_predictor {
   std::size_t get_base_index(champsim::address ip);
   std::size_t get_tag_index(champsim::address ip, std::size_t table_idx);
   uint64_t get_partial_tag(champsim::address ip, std::size_t table_idx);
-  uint64_t get_compressed_history(std::size_t history_length, std::size_t width);
   
   // MPC functions
   std::size_t get_mpc_index(champsim::address ip);
   bool check_mpc_override(champsim::address ip, bool tage_pred);
   void update_mpc(champsim::address ip, bool taken, bool was_correct);
   
+  // Confidence functions
+  template <std::size_t WIDTH>
+  static std::size_t get_counter_strength(const champsim::msl::fwcounter<WIDTH>& counter);
+  confidence_level classify_confidence(std::size_t conf_class) const;
+  void update_confidence(bool taken);
+  void print_confidence_stats() const;
+  
+  // Confidence of the last predict_branch() result, for fetch gating and speculation throttling
+  confidence_level get_confidence() const { return last_confidence; }
+  
   // ChampSim interface
   bool predict_branch(champsim::address ip);
   void last_branch_result(champsim::address ip, champsim::address branch_target, bool taken, uint8_t branch_type);
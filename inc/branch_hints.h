@@ -0,0 +1,72 @@
+#ifndef BRANCH_HINTS_H
+#define BRANCH_HINTS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Channel between the branch predictor and the prefetchers of the same core: tage publishes
+// its confident predictions and myl1pref consumes them to prefetch for the predicted path.
+// Compile with -DBRANCH_HINT_CHANNEL=0 to remove it, the rings then always look empty
+#ifndef BRANCH_HINT_CHANNEL
+#define BRANCH_HINT_CHANNEL 1
+#endif
+
+constexpr std::size_t BRANCH_HINT_MAX_CPUS = 64;
+constexpr std::size_t BRANCH_HINT_RING_SIZE = 64; // Power of two
+
+struct branch_hint_t {
+  uint64_t ip = 0;
+  bool taken = false;
+};
+
+// Single producer (the core's branch predictor), single consumer (one of its prefetchers), lock-free.
+// The producer never waits nor drops: it overwrites the oldest slot. The consumer only wants the newest
+// hint, the older ones guided loads that are already past, so it jumps straight to the head
+class branch_hint_ring {
+  std::array<std::atomic<uint64_t>, BRANCH_HINT_RING_SIZE> hints{}; // IP << 1 | taken
+  std::atomic<uint64_t> head{0}; // Hints published so far, only the producer moves it
+  uint64_t consumed = 0;         // Head seen by the last consume, consumer side only
+  uint64_t skipped = 0;
+
+public:
+  void publish(const branch_hint_t& hint) {
+#if BRANCH_HINT_CHANNEL
+    uint64_t h = head.load(std::memory_order_relaxed);
+    hints[h % BRANCH_HINT_RING_SIZE].store((hint.ip << 1) | static_cast<uint64_t>(hint.taken), std::memory_order_relaxed);
+    head.store(h + 1, std::memory_order_release);
+#else
+    (void)hint;
+#endif
+  }
+
+  // Newest hint published since the last call, if any
+  bool consume_newest(branch_hint_t& hint) {
+    for (;;) {
+      uint64_t h = head.load(std::memory_order_acquire);
+      if (h == consumed)
+        return false;
+      uint64_t packed = hints[(h - 1) % BRANCH_HINT_RING_SIZE].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      // The producer went around the whole ring while we read: the slot may hold a newer hint, read again
+      if (head.load(std::memory_order_relaxed) >= h - 1 + BRANCH_HINT_RING_SIZE)
+        continue;
+
+      skipped += h - consumed - 1;
+      consumed = h;
+      hint.ip = packed >> 1;
+      hint.taken = packed & 1;
+      return true;
+    }
+  }
+
+  uint64_t published() const { return head.load(std::memory_order_relaxed); }
+  uint64_t skipped_hints() const { return skipped; }
+};
+
+inline branch_hint_ring& get_branch_hint_ring(std::size_t cpu) {
+  static std::array<branch_hint_ring, BRANCH_HINT_MAX_CPUS> rings;
+  return rings[cpu % BRANCH_HINT_MAX_CPUS];
+}
+
+#endif
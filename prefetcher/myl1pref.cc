@@ -3,210 +3,674 @@
 #include <string>
 #include <algorithm>
 #include <iostream>
-#include <iomanip>
+#include <fstream>
+#include <cstdlib>
+#include <bit>
+#include <cctype>
+#include <type_traits>
+
+myl1pref_tuning_t myl1pref::default_tuning() const {
+    myl1pref_tuning_t tuning;
+    switch (detect_level()) {
+        case PrefetcherLevel::L1D: tuning.level_config = L1D_LEVEL_CONFIG; break;
+        case PrefetcherLevel::L2C: tuning.level_config = L2C_LEVEL_CONFIG; break;
+        case PrefetcherLevel::LLC: tuning.level_config = LLC_LEVEL_CONFIG; break;
+    }
+    return tuning;
+}
 
 void myl1pref::prefetcher_initialize() {
+    initialize_with(default_tuning());
+}
 
-    AHT_table.resize(DHT_AHT_NUM_ENTRIES);
-    PHT_table.resize(DHT_PHT_NUM_ENTRIES);
-    RP_table.resize(RP_NUM_SETS);
-    for (auto& set : RP_table) {
-        set.resize(RP_NUM_WAYS);
-    }
-    src_lru_way.resize(RP_NUM_SETS, 0);
+void myl1pref::initialize_with(const myl1pref_tuning_t& tuning) {
 
-    for (auto& entry : AHT_table) entry.reset();
-    for (auto& entry : PHT_table) entry.reset();
-    for (auto& set : RP_table) {
-        for (auto& entry : set) entry.reset();
-    }
+    level = detect_level();
+    level_config = tuning.level_config;
+    pq_size = intern_->get_pq_size().back();
 
-    num_prefetches_issued_nl = 0;
-    num_prefetches_useful_nl = 0; 
-    num_prefetches_issued_tdc = 0;
-    num_prefetches_useful_tdc = 0;
-    num_prefetches_issued_src = 0;
-    num_prefetches_useful_src = 0;
-    num_prefetches_useful_total_champsim = 0;
-    pq_hits_nl_total = 0;
-    pq_hits_tdc_total = 0;
-    pq_hits_src_total = 0;
+    std::apply([this](auto&... engine) { (engine.initialize(level_config), ...); }, engines);
+    if (level_config.branch_hints)
+        std::get<bg_engine>(engines).attach(get_branch_hint_ring(detect_cpu()));
+    recent_request_table.assign(RECENT_REQ_NUM_ENTRIES, 0);
+    recent_request_engine.assign(RECENT_REQ_NUM_ENTRIES, PrefetchSourceEngine::NONE);
+    recent_request_this_level.assign(RECENT_REQ_NUM_ENTRIES, 0);
+    unused_prefetches.clear();
+    candidate_queue.clear();
+    candidate_queue.reserve(CANDIDATE_QUEUE_SIZE);
+    drop_cross_page_prefetches = !intern_->virtual_prefetch;
 
+    for (auto& state : engine_state) state = engine_state_t{};
+    num_prefetches_useful_total_champsim = 0;
+    num_filtered_cross_page = 0;
+    num_flagged_cross_page = 0;
+    num_filtered_duplicate = 0;
+    num_candidates_merged = 0;
+    num_candidates_evicted = 0;
+    num_candidates_stale = 0;
+    num_candidates_demanded = 0;
 
     current_phase = PrefetcherPhase::PHASE_EXPLORE;
     phase_cycle_counter = 0;
-    explore_duration_cycles = 256000; 
-    exploit_duration_cycles = 256000 * 3; 
-    allowed_tdc = false;
-    allowed_src = false;
-    allowed_nl = false;
+    explore_duration_cycles = tuning.explore_duration_cycles;
+    exploit_duration_cycles = tuning.exploit_duration_cycles;
+
+    aging_epoch = 0;
+    aging_cycle_counter = 0;
+    aging_interval_cycles = tuning.aging_interval_cycles;
 
     reset_scores_and_pq_tracking(); 
+}
 
-    nl_prefetch_degree = 1;
+void myl1pref::reset_scores_and_pq_tracking() {
+    for (auto& state : engine_state) {
+        state.score = 0;
+        state.recent_prefetches.clear();
+    }
+}
 
-    printf("  AHT Table Entries: %u\n", DHT_AHT_NUM_ENTRIES);
-    printf("  PHT Table Entries: %u\n", DHT_PHT_NUM_ENTRIES);
-    printf("  RP Table Sets: %u, Ways: %u, Total Entries: %u\n", RP_NUM_SETS, RP_NUM_WAYS, RP_NUM_SETS * RP_NUM_WAYS);
-    printf("  NL Prefetch Degree: %u\n", nl_prefetch_degree);
-    printf("  EXPLORE Phase Duration: %lu cycles\n", explore_duration_cycles);
-    printf("  EXPLOIT Phase Duration: %lu cycles\n", exploit_duration_cycles);
-    printf("  Score System: PQ Hit Based, Positive Feedback Only.\n");
-    printf("  NL Reward: %d, DHT Reward: %d, RP Reward: %d\n", PQ_HIT_REWARD_NL, PQ_HIT_REWARD_DHT, PQ_HIT_REWARD_RP);
-    printf("  Max Score: %d\n", SCORE_MAX_PQ_HIT);
-    printf("  Max Recent Prefetches Tracked per Engine: %zu\n", MAX_RECENT_PF_TRACKING);
-    printf("  Initial Phase: EXPLORE. Scores & PQ Tracking reset.\n");
+uint64_t myl1pref::current_cycle() const {
+    return static_cast<uint64_t>(intern_->current_time.time_since_epoch() / intern_->clock_period);
 }
 
-void myl1pref::reset_scores_and_pq_tracking() {
-    score_nl = 0;
-    score_tdc = 0;
-    score_src = 0;
-    recent_prefetches_nl.clear();
-    recent_prefetches_tdc.clear();
-    recent_prefetches_src.clear();
+// The level config must match the cache: an unknown name stops the simulation instead of guessing
+PrefetcherLevel myl1pref::detect_level() const {
+    if (intern_->NAME.find("LLC") != std::string::npos)
+        return PrefetcherLevel::LLC;
+    if (intern_->NAME.find("L2") != std::string::npos)
+        return PrefetcherLevel::L2C;
+    if (intern_->NAME.find("L1D") != std::string::npos)
+        return PrefetcherLevel::L1D;
+
+    std::cerr << "myl1pref: can not tell the level of cache \"" << intern_->NAME
+              << "\", its name must contain L1D, L2 or LLC" << std::endl;
+    std::abort();
+}
+
+// Default ChampSim cache names start with the core they belong to, e.g. cpu0_L1D
+std::size_t myl1pref::detect_cpu() const {
+    const std::string& name = intern_->NAME;
+    if (name.rfind("cpu", 0) != 0)
+        return 0;
+    std::size_t cpu = 0;
+    for (std::size_t i = 3; i < name.size() && std::isdigit(static_cast<unsigned char>(name[i])); ++i)
+        cpu = cpu * 10 + static_cast<std::size_t>(name[i] - '0');
+    return cpu;
 }
 
-uint32_t myl1pref::get_aht_index(uint64_t pc) const {
-    return pc & (DHT_AHT_NUM_ENTRIES - 1);
+// ===== DHT engine =====
+
+void dht_engine::initialize(const level_config_t& config) {
+    level_config = config;
+    AHT_table.resize(1ULL << level_config.aht_index_bits);
+    for (auto& table : PHT_tables)
+        table.resize(1ULL << level_config.pht_index_bits);
+    pht_predictions.fill(0);
+    pht_hits.fill(0);
+}
+
+void dht_engine::report_config(config_counters_t& counters) const {
+    counters.emplace_back("aht_entries", AHT_table.size());
+    counters.emplace_back("pht_tables", PHT_tables.size());
+    counters.emplace_back("pht_entries", PHT_tables[0].size());
+    for (std::size_t i = 0; i < PHT_tables.size(); ++i)
+    {
+        counters.emplace_back("dht_predictions_pht" + std::to_string(i + 1), pht_predictions[i]);
+        counters.emplace_back("dht_hits_pht" + std::to_string(i + 1), pht_hits[i]);
+    }
 }
 
-uint16_t myl1pref::get_aht_tag(uint64_t pc) const {
-    return (pc >> DHT_AHT_TAG_INITIAL_SHIFT) & 0xFFFF;
+uint32_t dht_engine::get_aht_index(uint64_t pc) const {
+    return pc & (AHT_table.size() - 1);
 }
 
-uint32_t myl1pref::get_pht_index(const std::array<int16_t, DHT_AHT_DELTA_HISTORY_SIZE>& delta_hist) const {
-    uint32_t hash = 1984; 
-    hash = hash ^ (static_cast<uint32_t>(delta_hist[0]) << 5);
-    hash = hash ^ (static_cast<uint32_t>(delta_hist[1]) << 11);
-    hash = hash ^ (static_cast<uint32_t>(delta_hist[2]) << 17);
+uint16_t dht_engine::get_aht_tag(uint64_t pc) const {
+    return (pc >> level_config.aht_index_bits) & 0xFFFF;
+}
+
+uint32_t dht_engine::get_pht_index(uint64_t history_key, unsigned length) const {
+    uint32_t hash = 1984 + length; 
+    for (unsigned i = 0; i < length; ++i)
+        hash = hash ^ (static_cast<uint32_t>(static_cast<uint16_t>(get_history_delta(history_key, i))) << (5 + 6 * i));
     hash = hash ^ (hash >> 16); hash = hash ^ (hash << 5);
-    return hash & (DHT_PHT_NUM_ENTRIES - 1);
+    return hash & (PHT_tables[length - 1].size() - 1);
+}
+
+// Entries are aged lazily: apply the decay of every epoch elapsed since the entry was last touched
+void dht_engine::age_pht_entry(DHT_PHT_table_t& table, uint32_t pht_idx) {
+    aging_epoch_t elapsed = (aging_epoch - table.epoch[pht_idx]) & AGING_EPOCH_MASK;
+    if (elapsed != 0) {
+        uint8_t& confidence = table.confidence[pht_idx];
+        confidence = (confidence > elapsed) ? static_cast<uint8_t>(confidence - elapsed) : 0;
+        table.epoch[pht_idx] = aging_epoch;
+    }
+}
+
+void dht_engine::age_all(aging_epoch_t current_epoch) {
+    aging_epoch = current_epoch;
+    for (auto& table : PHT_tables)
+        for (uint32_t idx = 0; idx < table.size(); ++idx)
+            age_pht_entry(table, idx);
+}
+
+void dht_engine::train_pht(DHT_PHT_table_t& table, uint64_t history_key, unsigned length, int16_t current_delta) {
+    uint64_t key = history_key & get_history_mask(length);
+    uint32_t pht_idx = get_pht_index(history_key, length);
+    age_pht_entry(table, pht_idx);
+
+    if (table.history_key[pht_idx] == key) {
+        if (table.predicted_next_delta[pht_idx] == current_delta) {
+            if (table.confidence[pht_idx] < DHT_PHT_CONFIDENCE_MAX)
+              table.confidence[pht_idx]++;
+
+        } else { 
+            if (table.confidence[pht_idx] > 0) 
+                table.confidence[pht_idx]--; 
+            else { 
+                table.predicted_next_delta[pht_idx] = current_delta;
+                table.confidence[pht_idx] = 0;
+            }
+        }
+    } else {
+        table.history_key[pht_idx] = key;
+        table.epoch[pht_idx] = aging_epoch;
+        table.predicted_next_delta[pht_idx] = current_delta;
+        table.confidence[pht_idx] = 1; 
+    }
+}
+
+void dht_engine::train(const prefetch_access_t& access, aging_epoch_t current_epoch) {
+    aging_epoch = current_epoch;
+    wants_to_prefetch = false;
+    if (!access.has_pc)
+        return;
+
+    uint32_t aht_idx = get_aht_index(access.pc);
+    uint32_t aht_tag_key = get_aht_tag(access.pc) | TAG_VALID_BIT;
+
+    if (AHT_table.tag_key[aht_idx] == aht_tag_key) {
+        if (AHT_table.last_accessed_block[aht_idx] != 0) {
+            int16_t current_delta = clamp_delta(static_cast<int64_t>(access.block_addr - AHT_table.last_accessed_block[aht_idx]));
+
+            if (current_delta != 0) {
+                // Judge the PHT that made the last prediction for this PC
+                uint8_t prediction_length = AHT_table.prediction_length[aht_idx];
+                if (prediction_length != 0 && AHT_table.predicted_delta[aht_idx] == current_delta)
+                    pht_hits[prediction_length - 1]++;
+                AHT_table.prediction_length[aht_idx] = 0;
+
+                // Every PHT whose history length is available learns the delta that followed it
+                uint64_t history_key = AHT_table.delta_history[aht_idx];
+                if (current_delta != DHT_DELTA_OUT_OF_RANGE) {
+                    for (unsigned length = 1; length <= DHT_AHT_DELTA_HISTORY_SIZE; ++length) {
+                        if (!history_is_usable(history_key, length))
+                            break;
+                        train_pht(PHT_tables[length - 1], history_key, length, current_delta);
+                    }
+                }
+                AHT_table.record_new_delta(aht_idx, current_delta);
+            }
+        }
+        AHT_table.last_accessed_block[aht_idx] = access.block_addr;
+    } else {
+      AHT_table.reset(aht_idx);
+      AHT_table.tag_key[aht_idx] = aht_tag_key;
+      AHT_table.last_accessed_block[aht_idx] = access.block_addr;
+    }
+
+    // Prediction, with the history that includes the current delta: the longest confident match wins
+    uint64_t history_key = AHT_table.delta_history[aht_idx];
+    for (unsigned length = DHT_AHT_DELTA_HISTORY_SIZE; length >= 1; --length) {
+        if (!history_is_usable(history_key, length))
+            continue;
+        DHT_PHT_table_t& table = PHT_tables[length - 1];
+        uint32_t pht_idx = get_pht_index(history_key, length);
+        age_pht_entry(table, pht_idx);
+        // The key also checks the delta history we indexed the entry with (potential hash colision)
+        if (table.history_key[pht_idx] == (history_key & get_history_mask(length)) &&
+            table.confidence[pht_idx] >= 2 &&
+            table.predicted_next_delta[pht_idx] != 0) {
+            wants_to_prefetch = true;
+            predicted_delta = table.predicted_next_delta[pht_idx];
+            fill_this_level = !level_config.low_confidence_fill_lower || table.confidence[pht_idx] >= DHT_PHT_CONFIDENCE_MAX;
+            pht_predictions[length - 1]++;
+            AHT_table.prediction_length[aht_idx] = static_cast<uint8_t>(length);
+            AHT_table.predicted_delta[aht_idx] = predicted_delta;
+            break;
+        }
+    }
+}
+
+// ===== RP engine =====
+
+void rp_engine::initialize(const level_config_t& config) {
+    level_config = config;
+    RP_table.assign(1ULL << level_config.rp_index_bits, RP_set_t{});
+    RP_PHT_table.resize(1ULL << level_config.rp_pht_index_bits);
+}
+
+void rp_engine::report_config(config_counters_t& counters) const {
+    counters.emplace_back("rp_sets", RP_table.size());
+    counters.emplace_back("rp_ways", RP_NUM_WAYS);
+    counters.emplace_back("rp_region_lines", RP_LINES_PER_REGION);
+    counters.emplace_back("rp_pht_entries", RP_PHT_table.size());
 }
 
-uint64_t myl1pref::get_src_region_address(uint64_t block_addr) const {
+uint64_t rp_engine::get_region_address(uint64_t block_addr) const {
     return block_addr >> RP_LINES_PER_REGION_LOG2;
 }
 
-uint8_t myl1pref::get_src_offset_in_region(uint64_t block_addr) const {
+uint8_t rp_engine::get_offset_in_region(uint64_t block_addr) const {
     return static_cast<uint8_t>(block_addr & RP_REGION_MASK);
 }
 
-uint32_t myl1pref::get_src_set_index(uint64_t region_addr) const {
-    return region_addr & (RP_NUM_SETS - 1);
+uint32_t rp_engine::get_set_index(uint64_t region_addr) const {
+    return region_addr & (RP_table.size() - 1);
 }
 
-uint64_t myl1pref::get_src_tag(uint64_t region_addr) const {
-    return (region_addr >> RP_INDEX_BITS);
+uint64_t rp_engine::get_tag(uint64_t region_addr) const {
+    return (region_addr >> level_config.rp_index_bits);
 }
 
-uint8_t myl1pref::find_src_victim(uint32_t set_idx) const {
-    return static_cast<uint8_t>(src_lru_way[set_idx]);
+uint8_t rp_engine::find_victim(const RP_set_t& set) const {
+    return set.lru_way;
 }
 
-void myl1pref::update_src_lru(uint32_t set_idx, bool accessed_way) {
-    if (RP_NUM_WAYS == 2) src_lru_way[set_idx] = !accessed_way;
+void rp_engine::update_lru(RP_set_t& set, bool accessed_way) {
+    if (RP_NUM_WAYS == 2) set.lru_way = !accessed_way;
+}
+
+uint32_t rp_engine::get_pattern_signature(uint64_t pc, uint8_t offset_in_region) const {
+    uint64_t hash = (pc << RP_LINES_PER_REGION_LOG2) | offset_in_region;
+    hash = hash ^ (hash >> 24) ^ (hash >> 48);
+    return static_cast<uint32_t>(hash & 0xFFFFFF);
+}
+
+// At the end of a region generation, remember which lines were touched
+void rp_engine::record_footprint(const RP_set_t& set, unsigned way) {
+    if (!(set.tag_key[way] & KEY_VALID_BIT))
+        return;
+    if (static_cast<unsigned>(std::popcount(set.access_bitmap[way])) < RP_PHT_MIN_FOOTPRINT_LINES)
+        return;
+
+    uint32_t pht_idx = set.pattern_signature[way] & (RP_PHT_table.size() - 1);
+    RP_PHT_table.tag_key[pht_idx] = ((set.pattern_signature[way] >> level_config.rp_pht_index_bits) & 0x3FFF) | TAG_VALID_BIT;
+    RP_PHT_table.footprint[pht_idx] = set.access_bitmap[way];
 }
 
+uint64_t rp_engine::lookup_footprint(uint32_t pattern_signature) const {
+    uint32_t pht_idx = pattern_signature & (RP_PHT_table.size() - 1);
+    if (RP_PHT_table.tag_key[pht_idx] == (((pattern_signature >> level_config.rp_pht_index_bits) & 0x3FFF) | TAG_VALID_BIT))
+        return RP_PHT_table.footprint[pht_idx];
+    return 0;
+}
+
+void rp_engine::age_entry(RP_set_t& set, unsigned way) const {
+    if (set.epoch[way] != aging_epoch) {
+        set.prefetch_bitmap[way] = 0;
+        set.epoch[way] = aging_epoch;
+    }
+}
+
+void rp_engine::age_all(aging_epoch_t current_epoch) {
+    aging_epoch = current_epoch;
+    for (auto& rp_set : RP_table)
+        for (unsigned way = 0; way < RP_NUM_WAYS; ++way)
+            age_entry(rp_set, way);
+}
+
+// Lines are marked prefetched only once they reach the PQ: candidates dropped from the queue get predicted again
+void rp_engine::prefetch_issued(uint64_t block_addr) {
+    uint64_t issued_region_addr = get_region_address(block_addr);
+    RP_set_t& issued_set = RP_table[get_set_index(issued_region_addr)];
+    uint64_t tag_key = get_tag(issued_region_addr) | KEY_VALID_BIT;
+    for (unsigned i = 0; i < RP_NUM_WAYS; ++i) {
+        if (issued_set.tag_key[i] == tag_key) {
+            age_entry(issued_set, i);
+            issued_set.prefetch_bitmap[i] |= (1ULL << get_offset_in_region(block_addr));
+            return;
+        }
+    }
+}
+
+void rp_engine::train(const prefetch_access_t& access, aging_epoch_t current_epoch) {
+    aging_epoch = current_epoch;
+    region_addr = get_region_address(access.block_addr);
+    set = &RP_table[get_set_index(region_addr)];
+    uint64_t tag_key = get_tag(region_addr) | KEY_VALID_BIT;
+    uint8_t offset_in_region = get_offset_in_region(access.block_addr);
+    int hit_way = -1;
+    candidate_bitmap = 0;
+    fill_this_level = !level_config.low_confidence_fill_lower; // Only learned footprints are confident
+
+    for (unsigned i = 0; i < RP_NUM_WAYS; ++i) { 
+        if (set->tag_key[i] == tag_key) { 
+            hit_way = (int)i; 
+            break; 
+        }
+    }
+    if (hit_way != -1) { 
+        way = (unsigned)hit_way;
+        age_entry(*set, way);
+        set->access_bitmap[way] |= (1ULL << offset_in_region);
+        update_lru(*set, static_cast<bool>(way));
+
+        // Regions without a learned footprint fall back to density-triggered prefetching
+        if (static_cast<unsigned>(std::popcount(set->access_bitmap[way])) >= RP_ACCESS_DENSITY_THRESHOLD)
+          candidate_bitmap = RP_FULL_FOOTPRINT;
+    } else {
+      // New region generation: the victim's footprint goes to the pattern history,
+      // and the footprint learned for this trigger (if any) is prefetched right away
+      way = find_victim(*set);
+      record_footprint(*set, way);
+      set->reset(way);
+      set->tag_key[way] = tag_key;
+      set->epoch[way] = aging_epoch;
+      set->pattern_signature[way] = get_pattern_signature(access.pc, offset_in_region);
+      set->access_bitmap[way] |= (1ULL << offset_in_region);
+      update_lru(*set, static_cast<bool>(way));
+
+      candidate_bitmap = lookup_footprint(set->pattern_signature[way]);
+      fill_this_level = true;
+    }
+}
+
+// ===== TC engine =====
+
+void tc_engine::initialize(const level_config_t& config) {
+    level_config = config;
+    TC_table.resize(1ULL << level_config.tc_history_bits, 1ULL << level_config.tc_index_bits);
+}
+
+void tc_engine::report_config(config_counters_t& counters) const {
+    counters.emplace_back("tc_history_entries", TC_table.history.size());
+    counters.emplace_back("tc_index_entries", TC_table.index_key.size());
+}
+
+uint32_t tc_engine::get_index(uint64_t block_addr) const {
+    uint64_t hash = block_addr ^ (block_addr >> level_config.tc_index_bits) ^ (block_addr >> (2 * level_config.tc_index_bits));
+    return hash & (TC_table.index_key.size() - 1);
+}
+
+// Records a miss and keeps the history positions that followed its previous occurrence, if still in the history
+void tc_engine::train(const prefetch_access_t& access, aging_epoch_t) {
+    successors_start = successors_end = 0;
+    // Miss stream only: hits would flood the history with addresses that need no prefetch
+    if (access.cache_hit && !access.useful_prefetch)
+        return;
+
+    uint32_t idx = get_index(access.block_addr);
+    uint64_t history_size = TC_table.history.size();
+
+    if (TC_table.index_key[idx] == (access.block_addr | KEY_VALID_BIT)) {
+        uint64_t last_position = TC_table.index_position[idx];
+        if (TC_table.history_head - last_position < history_size) {
+            successors_start = last_position + 1;
+            successors_end = std::min<uint64_t>(successors_start + TC_PREFETCH_DEGREE, TC_table.history_head);
+        }
+    }
+
+    TC_table.history[TC_table.history_head % history_size] = access.block_addr;
+    TC_table.index_key[idx] = access.block_addr | KEY_VALID_BIT;
+    TC_table.index_position[idx] = TC_table.history_head;
+    TC_table.history_head++;
+}
+
+// ===== BG engine =====
+
+void bg_engine::initialize(const level_config_t& config) {
+    level_config = config;
+    BG_table.resize(1ULL << BG_INDEX_BITS);
+    hints = nullptr;
+    hints_consumed = 0;
+    recorded_blocks = BG_BLOCKS_PER_PATH;
+}
+
+void bg_engine::report_config(config_counters_t& counters) const {
+    counters.emplace_back("bg_entries", BG_table.size());
+    counters.emplace_back("bg_hints_consumed", hints_consumed);
+    counters.emplace_back("bg_hints_skipped", hints ? hints->skipped_hints() : 0);
+}
+
+uint32_t bg_engine::get_index(uint64_t path_key) const {
+    // The low bit is the direction: both directions of a branch are different paths
+    uint64_t hash = path_key ^ (path_key >> BG_INDEX_BITS) ^ (path_key >> (2 * BG_INDEX_BITS));
+    return hash & (BG_table.size() - 1);
+}
+
+// Hints arrive well ahead of the loads of the path, so an entry learns the first accesses seen after its hint
+void bg_engine::train(const prefetch_access_t& access, aging_epoch_t) {
+    wants_to_prefetch = false;
+    if (hints == nullptr)
+        return;
+
+    if (recorded_blocks < BG_BLOCKS_PER_PATH) {
+        int16_t delta = clamp_delta(static_cast<int64_t>(access.block_addr - anchor_block));
+        if (delta != 0 && delta != DHT_DELTA_OUT_OF_RANGE) {
+            // The path is recorded again every time, the data it touches may have moved since
+            if (recorded_blocks == 0)
+                std::fill_n(BG_table.deltas.begin() + recording_idx * BG_BLOCKS_PER_PATH, BG_BLOCKS_PER_PATH, 0);
+            BG_table.deltas[recording_idx * BG_BLOCKS_PER_PATH + recorded_blocks++] = delta;
+        }
+    }
+
+    // Only the newest hint matters: the older ones are paths the loads already went through
+    branch_hint_t hint;
+    if (!hints->consume_newest(hint))
+        return;
+    hints_consumed++;
+
+    uint64_t path_key = ((hint.ip << 1) | static_cast<uint64_t>(hint.taken)) | KEY_VALID_BIT;
+    uint32_t idx = get_index(path_key);
+    if (BG_table.path_key[idx] == path_key) {
+        wants_to_prefetch = BG_table.deltas[idx * BG_BLOCKS_PER_PATH] != 0;
+        predicted_idx = idx;
+    } else {
+        BG_table.path_key[idx] = path_key;
+        std::fill_n(BG_table.deltas.begin() + idx * BG_BLOCKS_PER_PATH, BG_BLOCKS_PER_PATH, 0);
+    }
+    recording_idx = idx;
+    recorded_blocks = 0;
+    anchor_block = access.block_addr;
+}
+
+// ===== Engine selection, scoring and issue =====
+
 void myl1pref::track_issued_prefetch(PrefetchSourceEngine engine_id, uint64_t block_address) {
-    std::deque<uint64_t>* tracking_queue = nullptr;
-    switch (engine_id) {
-        case PrefetchSourceEngine::NL: tracking_queue = &recent_prefetches_nl; break;
-        case PrefetchSourceEngine::DHT: tracking_queue = &recent_prefetches_tdc; break;
-        case PrefetchSourceEngine::RP: tracking_queue = &recent_prefetches_src; break;
-        default: return; 
-    }
-    if (tracking_queue) {
-        tracking_queue->push_front(block_address);
-        if (tracking_queue->size() > MAX_RECENT_PF_TRACKING) {
-            tracking_queue->pop_back();
+    if (engine_id == PrefetchSourceEngine::NONE)
+        return;
+    std::deque<uint64_t>& tracking_queue = engine_state[engine_id].recent_prefetches;
+    tracking_queue.push_front(block_address);
+    if (tracking_queue.size() > MAX_RECENT_PF_TRACKING) {
+        tracking_queue.pop_back();
+    }
+}
+
+uint32_t myl1pref::get_recent_request_index(uint64_t block_addr) const {
+    return (block_addr ^ (block_addr >> RECENT_REQ_INDEX_BITS)) & (RECENT_REQ_NUM_ENTRIES - 1);
+}
+
+// A prefetch that only fills the next level is no request for this one: it never fills here
+bool myl1pref::recently_requested(uint64_t block_addr, bool fill_this_level) const {
+    uint32_t idx = get_recent_request_index(block_addr);
+    return recent_request_table[idx] == block_addr && (recent_request_this_level[idx] || !fill_this_level);
+}
+
+// Engine whose prefetch of the block is in flight to this level
+PrefetchSourceEngine myl1pref::find_recent_request(uint64_t block_addr) const {
+    if (!recently_requested(block_addr, true))
+        return PrefetchSourceEngine::NONE;
+    return static_cast<PrefetchSourceEngine>(recent_request_engine[get_recent_request_index(block_addr)]);
+}
+
+// Shared by all engines before anything reaches the candidate queue. Returns false if the prefetch must not be sent
+bool myl1pref::filter_prefetch(uint64_t prefetch_block_addr, uint64_t trigger_block_addr, bool fill_this_level) {
+    constexpr unsigned page_shift = LOG2_PAGE_SIZE - LOG2_CACHE_LINE_SIZE;
+    if ((prefetch_block_addr >> page_shift) != (trigger_block_addr >> page_shift)) {
+        if (drop_cross_page_prefetches) {
+            num_filtered_cross_page++;
+            return false;
         }
+        num_flagged_cross_page++;
+    }
+
+    if (recently_requested(prefetch_block_addr, fill_this_level)) {
+        num_filtered_duplicate++;
+        return false;
+    }
+    return true;
+}
+
+// Returns true if the block is, or will be, requested: queued now, already queued, or its prefetch is in flight
+bool myl1pref::enqueue_candidate(uint64_t prefetch_block_addr, uint64_t trigger_block_addr, PrefetchSourceEngine engine_id, bool fill_this_level, unsigned distance) {
+    if (!filter_prefetch(prefetch_block_addr, trigger_block_addr, fill_this_level))
+        return recently_requested(prefetch_block_addr, fill_this_level);
+
+    int rank = engine_state[engine_id].score + (fill_this_level ? CANDIDATE_CONFIDENT_BONUS : 0)
+               - static_cast<int>(distance) * CANDIDATE_DISTANCE_PENALTY;
+
+    // Several engines predicting the same block: keep one candidate with the best rank, filling here if any of them does
+    auto same_block = std::find_if(candidate_queue.begin(), candidate_queue.end(),
+                                   [prefetch_block_addr](const prefetch_candidate_t& c) { return c.block_addr == prefetch_block_addr; });
+    if (same_block != candidate_queue.end()) {
+        num_candidates_merged++;
+        if (rank > same_block->rank) {
+            same_block->rank = rank;
+            same_block->engine_id = engine_id;
+        }
+        same_block->fill_this_level |= fill_this_level;
+        return true;
+    }
+
+    prefetch_candidate_t candidate{prefetch_block_addr, engine_id, fill_this_level, rank, current_cycle()};
+    if (candidate_queue.size() < CANDIDATE_QUEUE_SIZE) {
+        candidate_queue.push_back(candidate);
+        return true;
+    }
+
+    auto worst = std::min_element(candidate_queue.begin(), candidate_queue.end(),
+                                  [](const prefetch_candidate_t& x, const prefetch_candidate_t& y) { return x.rank < y.rank; });
+    if (worst->rank >= rank)
+        return false;
+    num_candidates_evicted++;
+    *worst = candidate;
+    return true;
+}
+
+// The demand is already on its way, a prefetch for it would only be late
+void myl1pref::drop_demanded_candidate(uint64_t demand_block_addr) {
+    auto it = std::find_if(candidate_queue.begin(), candidate_queue.end(),
+                           [demand_block_addr](const prefetch_candidate_t& c) { return c.block_addr == demand_block_addr; });
+    if (it != candidate_queue.end()) {
+        num_candidates_demanded++;
+        *it = candidate_queue.back();
+        candidate_queue.pop_back();
+    }
+}
+
+// Sends the best ranked candidates while the PQ has room. Runs every cycle: an empty queue costs one
+// compare, and a candidate is only checked for staleness when it is the next one to go
+void myl1pref::drain_candidate_queue() {
+    if (candidate_queue.empty())
+        return;
+
+    uint64_t now = current_cycle();
+    while (!candidate_queue.empty()) {
+        auto best = std::max_element(candidate_queue.begin(), candidate_queue.end(),
+                                     [](const prefetch_candidate_t& x, const prefetch_candidate_t& y) { return x.rank < y.rank; });
+        if (now - best->enqueue_cycle > CANDIDATE_MAX_AGE_CYCLES)
+            num_candidates_stale++;
+        else if (!issue_prefetch_wrapper(best->block_addr << LOG2_CACHE_LINE_SIZE, best->engine_id, best->fill_this_level))
+            break;
+        *best = candidate_queue.back();
+        candidate_queue.pop_back();
     }
 }
 
-bool myl1pref::issue_prefetch_wrapper(uint64_t prefetch_address, PrefetchSourceEngine engine_id) {
+bool myl1pref::issue_prefetch_wrapper(uint64_t prefetch_address, PrefetchSourceEngine engine_id, bool fill_this_level) {
     champsim::address addr{prefetch_address};
+    uint64_t prefetch_block_addr = prefetch_address >> LOG2_CACHE_LINE_SIZE;
     uint64_t PQ_occupancy = intern_->get_pq_occupancy().back();
 
-    if (PQ_occupancy < MAX_PQ_SIZE) {
-        bool success = intern_->prefetch_line(addr, true, static_cast<uint32_t>(engine_id)); 
+    if (PQ_occupancy < pq_size) {
+        bool success = intern_->prefetch_line(addr, fill_this_level, static_cast<uint32_t>(engine_id)); 
         if (success) {
-            uint64_t prefetch_block_addr = prefetch_address >> LOG2_CACHE_LINE_SIZE;
+            // Replaces a request for the next level only: filling here covers it
+            uint32_t recent_idx = get_recent_request_index(prefetch_block_addr);
+            recent_request_table[recent_idx] = prefetch_block_addr;
+            recent_request_engine[recent_idx] = engine_id;
+            recent_request_this_level[recent_idx] = fill_this_level;
             track_issued_prefetch(engine_id, prefetch_block_addr);
-            switch (engine_id) {
-                case PrefetchSourceEngine::NL: num_prefetches_issued_nl++;
-                  break;
-                case PrefetchSourceEngine::DHT: num_prefetches_issued_tdc++;
-                  break;
-                case PrefetchSourceEngine::RP: num_prefetches_issued_src++;
-                  break;
-                case PrefetchSourceEngine::NONE:
-                  break;
-            }
+            telemetry.count_issued(engine_id);
+            engine_state[engine_id].issued++;
+            std::apply([&](auto&... engine) {
+                ((std::decay_t<decltype(engine)>::id == engine_id ? engine.prefetch_issued(prefetch_block_addr) : void()), ...);
+            }, engines);
             return true;
         }
     }
     return false;
 }
 
-void myl1pref::check_pq_hits(uint64_t demand_block_address) {
-
-    // CAM
-    auto it_nl = std::find(recent_prefetches_nl.begin(), recent_prefetches_nl.end(), demand_block_address);
-    if (it_nl != recent_prefetches_nl.end()) {
-        score_nl = std::min(SCORE_MAX_PQ_HIT, score_nl + PQ_HIT_REWARD_NL); 
-        pq_hits_nl_total++;
-        recent_prefetches_nl.erase(it_nl); 
-        return; 
-    }
-
-    auto it_tdc = std::find(recent_prefetches_tdc.begin(), recent_prefetches_tdc.end(), demand_block_address);
-    if (it_tdc != recent_prefetches_tdc.end()) {
-        score_tdc = std::min(SCORE_MAX_PQ_HIT, score_tdc + PQ_HIT_REWARD_DHT); 
-        pq_hits_tdc_total++;
-        recent_prefetches_tdc.erase(it_tdc);
+template <typename Engine>
+void myl1pref::issue_engine_prefetches(Engine& engine, const prefetch_access_t& access) {
+    if (current_phase == PrefetcherPhase::PHASE_EXPLOIT && !engine_state[Engine::id].allowed)
         return;
-    }
+    unsigned distance = 0;
+    engine.predict(access, [this, &distance](uint64_t block_addr, uint64_t trigger_block_addr, bool fill_this_level) {
+        return enqueue_candidate(block_addr, trigger_block_addr, Engine::id, fill_this_level, distance++);
+    });
+}
 
-    auto it_src = std::find(recent_prefetches_src.begin(), recent_prefetches_src.end(), demand_block_address);
-    if (it_src != recent_prefetches_src.end()) {
-        score_src = std::min(SCORE_MAX_PQ_HIT, score_src + PQ_HIT_REWARD_RP); 
-        pq_hits_src_total++;
-        recent_prefetches_src.erase(it_src);
-        return;
+void myl1pref::check_pq_hits(uint64_t demand_block_address) {
+
+    // CAM, first engine in issue order wins
+    for (std::size_t id = 1; id < NUM_PREFETCH_SOURCES; ++id) {
+        engine_state_t& state = engine_state[id];
+        auto it = std::find(state.recent_prefetches.begin(), state.recent_prefetches.end(), demand_block_address);
+        if (it != state.recent_prefetches.end()) {
+            state.score = std::min(SCORE_MAX_PQ_HIT, state.score + engine_traits::pq_hit_reward[id]); 
+            state.pq_hits++;
+            state.recent_prefetches.erase(it); 
+            return; 
+        }
     }
 }
 
 
 void myl1pref::determine_best_engine_for_exploit() {
-    // in case of tie, DHT > RP > NL
-    
-    allowed_tdc = allowed_src = allowed_nl = 0;
+    // in case of tie, the lowest selection_priority wins (DHT > TC > RP > NL)
+
+    for (auto& state : engine_state) state.allowed = false;
     int max_score = -1; 
 
-    if (score_tdc >= max_score) { 
-        max_score = score_tdc;
-        allowed_tdc = true;
+    for (std::size_t rank = 0; rank < engine_traits::selection_order.size(); ++rank) {
+        engine_state_t& candidate = engine_state[engine_traits::selection_order[rank]];
+        bool selected = (rank == 0) ? (candidate.score >= max_score)
+                                    : (candidate.score > max_score || candidate.score > SCORE_THRESHOLD_PREFETCHER);
+        if (selected) {
+            max_score = candidate.score;
+            // Engines preferred on ties only stay enabled next to it if they also passed the threshold
+            for (std::size_t prev = 0; prev < rank; ++prev) {
+                engine_state_t& previous = engine_state[engine_traits::selection_order[prev]];
+                if (previous.score < SCORE_THRESHOLD_PREFETCHER)
+                    previous.allowed = false;
+            }
+            candidate.allowed = true;
+        }
     }
 
-    if (score_src > max_score || score_src > SCORE_THRESHOLD_PREFETCHER) {
-        max_score = score_src;
-        if (score_tdc < SCORE_THRESHOLD_PREFETCHER)
-            allowed_tdc = false;
-        allowed_src = true;
-    }
-    
-    if (score_nl > max_score || score_nl > SCORE_THRESHOLD_PREFETCHER) {
-        if (score_tdc < SCORE_THRESHOLD_PREFETCHER)
-            allowed_tdc = false;
-        if (score_src < SCORE_THRESHOLD_PREFETCHER)
-            allowed_src = false;
-        allowed_nl = true;
-    } 
+    close_telemetry_interval(PrefetcherPhase::PHASE_EXPLORE);
+}
 
-    printf("[%lu] EXPLORE phase ended. PQ Hit Scores: NL=%d, DHT=%d, RP=%d. Selected for EXPLOIT: Engines %d%d%d.\n",
-     (intern_->current_time.time_since_epoch() / intern_->clock_period),
-           score_nl, score_tdc, score_src, allowed_nl, allowed_tdc, allowed_src);
+void myl1pref::close_telemetry_interval(PrefetcherPhase phase) {
+    std::array<int, NUM_PREFETCH_SOURCES> scores{};
+    std::array<bool, NUM_PREFETCH_SOURCES> selected{};
+    for (std::size_t id = 1; id < NUM_PREFETCH_SOURCES; ++id) {
+        scores[id] = engine_state[id].score;
+        selected[id] = engine_state[id].allowed;
+    }
+    telemetry.close_interval(current_cycle(), phase, scores, selected);
 }
 
 void myl1pref::manage_phase_transitions() {
@@ -215,15 +679,20 @@ void myl1pref::manage_phase_transitions() {
     if (current_phase == PrefetcherPhase::PHASE_EXPLORE) {
         if (phase_cycle_counter >= explore_duration_cycles) {
             determine_best_engine_for_exploit();
+            // Candidates of engines that were not selected do not get issued in EXPLOIT
+            candidate_queue.erase(std::remove_if(candidate_queue.begin(), candidate_queue.end(),
+                                                 [this](const prefetch_candidate_t& c) { return !engine_state[c.engine_id].allowed; }),
+                                  candidate_queue.end());
             current_phase = PrefetcherPhase::PHASE_EXPLOIT;
             phase_cycle_counter = 0;
         }
     } else {
         if (phase_cycle_counter >= exploit_duration_cycles) {
+            close_telemetry_interval(PrefetcherPhase::PHASE_EXPLOIT);
             current_phase = PrefetcherPhase::PHASE_EXPLORE;
             phase_cycle_counter = 0;
             reset_scores_and_pq_tracking(); 
-            allowed_tdc = allowed_src = allowed_nl = 0;
+            for (auto& state : engine_state) state.allowed = false;
         }
     }
 }
@@ -234,201 +703,48 @@ uint32_t myl1pref::prefetcher_cache_operate(
     champsim::address addr, champsim::address ip, bool cache_hit, bool useful_prefetch,
     access_type type, uint32_t metadata_in) {
 
-    bool is_demand_access = type == access_type::LOAD;
+    bool is_training_access = (level_config.train_access_types & access_type_bit(type)) != 0;
+    bool is_demand_access = is_training_access && type != access_type::PREFETCH;
     uint64_t current_block_addr_val = addr.to<uint64_t>() >> LOG2_CACHE_LINE_SIZE;
 
     if (is_demand_access) {
         check_pq_hits(current_block_addr_val); 
+        drop_demanded_candidate(current_block_addr_val);
     }
-    
-    if (!is_demand_access || ip.to<uint64_t>() == 0) {
-        return useful_prefetch ? metadata_in : 0; 
-    }
-
-    champsim::address current_pc = ip;
 
-    // Train DHT
-    uint32_t aht_idx = get_aht_index(current_pc.to<uint64_t>());
-    uint16_t aht_tag_val = get_aht_tag(current_pc.to<uint64_t>());
-    DHT_AHT_entry_t& aht_entry = AHT_table[aht_idx];
-
-    if (aht_entry.valid && aht_entry.tag == aht_tag_val) {
-        if (aht_entry.last_accessed_block != 0) {
-            int16_t current_delta = static_cast<int16_t>(current_block_addr_val - aht_entry.last_accessed_block);
-
-            if (current_delta != 0) {
-                uint32_t pht_idx = get_pht_index(aht_entry.delta_history);
-                DHT_PHT_entry_t& pht_entry = PHT_table[pht_idx];
-                bool pht_tag_match = std::equal(pht_entry.tag_delta_history.begin(), pht_entry.tag_delta_history.end(), aht_entry.delta_history.begin());
-
-                if (pht_entry.valid && pht_tag_match) {
-                    if (pht_entry.predicted_next_delta == current_delta) {
-                        if (pht_entry.confidence < DHT_PHT_CONFIDENCE_MAX)
-                          pht_entry.confidence++;
-
-                    } else { 
-                        if (pht_entry.confidence > 0) 
-                            pht_entry.confidence--; 
-                        else { 
-                            pht_entry.predicted_next_delta = current_delta;
-                            pht_entry.confidence = 0;
-                        }
-                    }
-                } else {
-                    pht_entry.reset();
-                    pht_entry.valid = true;
-                    pht_entry.tag_delta_history = aht_entry.delta_history;
-                    pht_entry.predicted_next_delta = current_delta;
-                    pht_entry.confidence = 1; 
-                }
-                aht_entry.record_new_delta(current_delta);
-            }
-        }
-        aht_entry.last_accessed_block = current_block_addr_val;
-    } else {
-      aht_entry.reset();
-      aht_entry.valid = true;
-      aht_entry.tag = aht_tag_val;
-      aht_entry.last_accessed_block = current_block_addr_val;
+    if (useful_prefetch) {
+        num_prefetches_useful_total_champsim++;
+        // The engine comes from the fill metadata. Any first use makes the prefetch useful,
+        // also the writes the engines do not train on
+        PrefetchSourceEngine useful_engine = unused_prefetches.take(current_block_addr_val);
+        if (useful_engine != PrefetchSourceEngine::NONE)
+            engine_state[useful_engine].useful++;
+        telemetry.count_useful(useful_engine);
+        if (type != access_type::PREFETCH)
+            profiler.record_covered(ip.to<uint64_t>(), current_block_addr_val, useful_engine);
+    } else if (is_demand_access && !cache_hit) {
+        // A demand miss on a block we just requested: the prefetch is still in flight
+        PrefetchSourceEngine late_engine = find_recent_request(current_block_addr_val);
+        if (late_engine != PrefetchSourceEngine::NONE)
+            telemetry.count_late(late_engine);
+        profiler.record_miss(ip.to<uint64_t>(), current_block_addr_val, late_engine);
     }
 
-    // Train RP
-    uint64_t region_addr_val = get_src_region_address(current_block_addr_val);
-    uint32_t src_set_idx = get_src_set_index(region_addr_val);
-    uint64_t src_tag_val = get_src_tag(region_addr_val);
-    uint8_t offset_in_region = get_src_offset_in_region(current_block_addr_val);
-    int src_hit_way = -1;
+    if (level_config.train_on_misses_only && cache_hit && !useful_prefetch)
+        is_training_access = false;
 
-    for (unsigned i = 0; i < RP_NUM_WAYS; ++i) { 
-        if (RP_table[src_set_idx][i].valid && RP_table[src_set_idx][i].region_address_tag == src_tag_val) { 
-            src_hit_way = (int)i; 
-            break; 
-        }
-    }
-    if (src_hit_way != -1) { 
-        RP_table[src_set_idx][(uint32_t)src_hit_way].access_bitmap |= (1U << offset_in_region);
-        update_src_lru(src_set_idx, static_cast<bool>(src_hit_way));
-    } else {
-      uint8_t victim_way = find_src_victim(src_set_idx);
-      RP_table[src_set_idx][victim_way].reset();
-      RP_table[src_set_idx][victim_way].valid = true;
-      RP_table[src_set_idx][victim_way].region_address_tag = src_tag_val;
-      RP_table[src_set_idx][victim_way].access_bitmap |= (1U << offset_in_region);
-      update_src_lru(src_set_idx, static_cast<bool>(victim_way));
+    // Below L1D, prefetch requests come without a PC: they still train the engines that do not need one
+    bool has_pc = ip.to<uint64_t>() != 0;
+    if (!is_training_access || (!has_pc && level == PrefetcherLevel::L1D)) {
+        return useful_prefetch ? metadata_in : 0; 
     }
 
+    prefetch_access_t access{current_block_addr_val, ip.to<uint64_t>(), has_pc, cache_hit, useful_prefetch};
 
-    if (current_phase == PrefetcherPhase::PHASE_EXPLORE) {
-        for (unsigned i = 1; i <= nl_prefetch_degree; ++i) {
-            uint64_t block_addr_to_prefetch = current_block_addr_val + i;
-            if (!issue_prefetch_wrapper(block_addr_to_prefetch << LOG2_CACHE_LINE_SIZE, PrefetchSourceEngine::NL))
-              break;
-        }
-
-        // DHT Prefetching
-        bool tdc_wants_to_prefetch = false; 
-        DHT_PHT_entry_t* p_pht_entry = nullptr;
-
-        if (aht_entry.valid && aht_entry.tag == aht_tag_val) { 
-            uint32_t pht_idx = get_pht_index(aht_entry.delta_history);
-            p_pht_entry = &PHT_table[pht_idx];
-            // If valid, check if the tag in the PHT table equals the delta history with which we indexed the entry (potential hash colision)
-            if (p_pht_entry->valid &&
-                std::equal(p_pht_entry->tag_delta_history.begin(), p_pht_entry->tag_delta_history.end(), aht_entry.delta_history.begin())
-                && p_pht_entry->confidence >= 2 &&
-                p_pht_entry->predicted_next_delta != 0) {
-                tdc_wants_to_prefetch = true;
-            }
-        }
-        if (tdc_wants_to_prefetch && p_pht_entry) {
-            uint64_t block_addr_to_prefetch = current_block_addr_val + p_pht_entry->predicted_next_delta;
-            issue_prefetch_wrapper(block_addr_to_prefetch << LOG2_CACHE_LINE_SIZE, PrefetchSourceEngine::DHT);
-        }
-
-        // RP Prefetching
-        bool src_wants_to_prefetch = false;
-        RP_entry_t* p_src_entry = nullptr;
-
-        if (src_hit_way != -1) { 
-            p_src_entry = &RP_table[src_set_idx][(uint32_t)src_hit_way];
-            uint8_t acc_lines = 0;
-            for (unsigned i = 0; i < RP_LINES_PER_REGION; ++i)
-              if ((p_src_entry->access_bitmap >> i) & 1U)
-                acc_lines++;
-            if (acc_lines >= RP_ACCESS_DENSITY_THRESHOLD)
-              src_wants_to_prefetch = true;
-        }
-        if (src_wants_to_prefetch && p_src_entry) {
-            for (unsigned i = 0; i < RP_LINES_PER_REGION; ++i) {
-                if (!((p_src_entry->access_bitmap >> i) & 1U) && !((p_src_entry->prefetch_bitmap >> i) & 1U)) {
-                    uint64_t base_region_b_addr = get_src_region_address(current_block_addr_val) << RP_LINES_PER_REGION_LOG2;
-                    uint64_t block_addr_to_prefetch = base_region_b_addr + i;
-                    if (issue_prefetch_wrapper(block_addr_to_prefetch << LOG2_CACHE_LINE_SIZE, PrefetchSourceEngine::RP)) {
-                        p_src_entry->prefetch_bitmap |= (1U << i);
-                    } else
-                      break;
-                }
-            }
-        }
-    } else { // Phase of using the best engine
-        if (allowed_nl) {
-            for (unsigned i = 1; i <= nl_prefetch_degree; ++i) {
-                uint64_t block_addr_to_prefetch = current_block_addr_val + i;
-                if (!issue_prefetch_wrapper(block_addr_to_prefetch << LOG2_CACHE_LINE_SIZE, PrefetchSourceEngine::NL))
-                  break;
-            }
-        }
-        if (allowed_tdc) {
-            bool tdc_wants_to_prefetch = false;
-            DHT_PHT_entry_t* p_pht_entry = nullptr;
-
-            if (aht_entry.valid && aht_entry.tag == aht_tag_val) { 
-                uint32_t pht_idx = get_pht_index(aht_entry.delta_history);
-                p_pht_entry = &PHT_table[pht_idx];
-
-                if (p_pht_entry->valid &&
-                    std::equal(p_pht_entry->tag_delta_history.begin(), p_pht_entry->tag_delta_history.end(), aht_entry.delta_history.begin()) &&
-                    p_pht_entry->confidence >= 2 &&
-                    p_pht_entry->predicted_next_delta != 0) {
-
-                    tdc_wants_to_prefetch = true;
-                }
-            }
+    // Every engine trains in EXPLORE and EXPLOIT; only the selected ones queue candidates in EXPLOIT
+    std::apply([&](auto&... engine) { (engine.train(access, aging_epoch), ...); }, engines);
+    std::apply([&](auto&... engine) { (issue_engine_prefetches(engine, access), ...); }, engines);
 
-            if (tdc_wants_to_prefetch && p_pht_entry) {
-                uint64_t block_addr_to_prefetch = current_block_addr_val + static_cast<int64_t>(p_pht_entry->predicted_next_delta);
-                issue_prefetch_wrapper(block_addr_to_prefetch << LOG2_CACHE_LINE_SIZE, PrefetchSourceEngine::DHT);
-            }
-        }
-        if (allowed_src) {
-            bool src_wants_to_prefetch = false;
-            RP_entry_t* p_src_entry = nullptr;
-            if (src_hit_way != -1) { 
-                p_src_entry = &RP_table[src_set_idx][(uint32_t)src_hit_way];
-                uint8_t acc_lines = 0;
-
-                for (unsigned i = 0; i < RP_LINES_PER_REGION; ++i)
-                  if ((p_src_entry->access_bitmap >> i) & 1U)
-                    acc_lines++;
-
-                if (acc_lines >= RP_ACCESS_DENSITY_THRESHOLD)
-                  src_wants_to_prefetch = true;
-            }
-            if (src_wants_to_prefetch && p_src_entry) {
-                for (unsigned i = 0; i < RP_LINES_PER_REGION; ++i) {
-                     if (!((p_src_entry->access_bitmap >> i) & 1U) && !((p_src_entry->prefetch_bitmap >> i) & 1U)) {
-                        uint64_t base_region_b_addr = get_src_region_address(current_block_addr_val) << RP_LINES_PER_REGION_LOG2;
-                        uint64_t block_addr_to_prefetch = base_region_b_addr + i;
-
-                        if (issue_prefetch_wrapper(block_addr_to_prefetch << LOG2_CACHE_LINE_SIZE, PrefetchSourceEngine::RP)) {
-                            p_src_entry->prefetch_bitmap |= (1U << i);
-                        } else
-                          break;
-                    }
-                }
-            }
-        }
-    }
     return useful_prefetch ? metadata_in : 0; 
 }
 
@@ -436,62 +752,251 @@ uint32_t myl1pref::prefetcher_cache_fill(
     champsim::address addr, uint32_t set, uint32_t way, bool prefetch,
     champsim::address evicted_address, uint32_t metadata_in) {
 
+    uint64_t block_addr = addr.to<uint64_t>() >> LOG2_CACHE_LINE_SIZE;
+    uint64_t evicted_block_addr = evicted_address.to<uint64_t>() >> LOG2_CACHE_LINE_SIZE;
+
+    if (unused_prefetches.take(evicted_block_addr) != PrefetchSourceEngine::NONE)
+        profiler.record_useless(evicted_block_addr);
+    // The block is here: it is no longer in flight
+    uint32_t recent_idx = get_recent_request_index(block_addr);
+    if (recent_request_table[recent_idx] == block_addr) {
+        recent_request_table[recent_idx] = 0;
+        recent_request_engine[recent_idx] = PrefetchSourceEngine::NONE;
+        recent_request_this_level[recent_idx] = 0;
+    }
+
+    // Our prefetches carry the engine id as metadata
+    if (prefetch && metadata_in > PrefetchSourceEngine::NONE && metadata_in < NUM_PREFETCH_SOURCES)
+        unused_prefetches.filled(block_addr, static_cast<PrefetchSourceEngine>(metadata_in));
+
     return metadata_in;
 }
 
 void myl1pref::prefetcher_cycle_operate() {
     manage_phase_transitions(); 
-
-    uint64_t current_cycle = (uint64_t) (intern_->current_time.time_since_epoch() / intern_->clock_period);
-    uint64_t confidence_decay_interval = 256000; 
-    // Decay with time
-    if ((current_cycle % confidence_decay_interval) == 0 && current_cycle > 0) {
-        for (auto& entry : PHT_table) if (entry.confidence > 0) entry.confidence--;
-        for (auto& set : RP_table) for (auto& way_entry : set) way_entry.prefetch_bitmap = 0;
-        
+    drain_candidate_queue();
+
+    // Decay with time: only the epoch advances here, entries catch up when next touched
+    if (++aging_cycle_counter >= aging_interval_cycles) {
+        aging_cycle_counter = 0;
+        aging_epoch = (aging_epoch + 1) & AGING_EPOCH_MASK;
+        if (aging_epoch % AGING_SWEEP_EPOCHS == 0)
+            std::apply([this](auto&... engine) { (engine.age_all(aging_epoch), ...); }, engines);
     }
 }
 
 void myl1pref::prefetcher_final_stats() {
-    std::cout << "Hybrid Prefetcher Final Statistics (Phased Explore/Exploit v7.2 - NL, DHT, RP):" << std::endl;
-    std::cout << "------------------------------------" << std::endl;
-    auto print_engine_stats = [](const std::string& name, uint64_t issued, uint64_t useful_champsim, uint64_t pq_hits) { 
-        std::cout << name << " Engine:" << std::endl;
-        std::cout << "  Prefetches Issued: " << issued << std::endl;
-        std::cout << "  PQ Hits (Used for Score): " << pq_hits << std::endl;
-        if (issued > 0) {
-            std::cout << "  PQ Hit Rate: " << std::fixed << std::setprecision(2) << (100.0 * (double)pq_hits / (double)issued) << "%" << std::endl;
-        } else {
-            std::cout << "  PQ Hit Rate: N/A" << std::endl;
-        }
-        std::cout << "  Useful by ChampSim (metadata match): " << useful_champsim << std::endl;
-         if (issued > 0 && useful_champsim >0) { 
-            std::cout << "  Accuracy (ChampSim useful / Issued): " << std::fixed << std::setprecision(2) << (100.0 * (double)useful_champsim / (double)issued) << "%" << std::endl;
-        } else {
-            std::cout << "  Accuracy (ChampSim useful / Issued): N/A" << std::endl;
-        }
+    config_counters_t counters;
+    std::apply([&counters](const auto&... engine) { (engine.report_config(counters), ...); }, engines);
+    counters.emplace_back("pq_size", pq_size);
+    counters.emplace_back("candidate_queue_size", CANDIDATE_QUEUE_SIZE);
+    counters.emplace_back("explore_duration_cycles", explore_duration_cycles);
+    counters.emplace_back("exploit_duration_cycles", exploit_duration_cycles);
+    counters.emplace_back("aging_interval_cycles", aging_interval_cycles);
+
+    for (std::size_t id = 1; id < NUM_PREFETCH_SOURCES; ++id) {
+        std::string name = engine_traits::names[id];
+        std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+        counters.emplace_back("issued_" + name, engine_state[id].issued);
+        counters.emplace_back("pq_hits_" + name, engine_state[id].pq_hits);
+        counters.emplace_back("useful_" + name, engine_state[id].useful);
+    }
+    counters.emplace_back("useful_total", num_prefetches_useful_total_champsim);
+    counters.emplace_back("filtered_cross_page", num_filtered_cross_page);
+    counters.emplace_back("flagged_cross_page", num_flagged_cross_page);
+    counters.emplace_back("filtered_duplicate", num_filtered_duplicate);
+    counters.emplace_back("candidates_merged", num_candidates_merged);
+    counters.emplace_back("candidates_evicted", num_candidates_evicted);
+    counters.emplace_back("candidates_stale", num_candidates_stale);
+    counters.emplace_back("candidates_demanded", num_candidates_demanded);
+
+    telemetry.dump(intern_->NAME, counters);
+    profiler.dump(intern_->NAME);
+}
+
+#if MYL1PREF_TELEMETRY
+void myl1pref_telemetry::close_interval(uint64_t cycle, PrefetcherPhase phase, const std::array<int, NUM_PREFETCH_SOURCES>& score,
+                                        const std::array<bool, NUM_PREFETCH_SOURCES>& selected) {
+    current.end_cycle = cycle;
+    current.phase = phase;
+    current.score = score;
+    current.selected = selected;
+
+    ring[ring_head] = current;
+    ring_head = (ring_head + 1) % TELEMETRY_RING_SIZE;
+    if (ring_count < TELEMETRY_RING_SIZE)
+        ring_count++;
+    else
+        dropped_intervals++;
+    current = telemetry_interval_t{};
+}
+
+// Written to $MYL1PREF_TELEMETRY_FILE if set (appending), stdout otherwise. $MYL1PREF_TELEMETRY_FORMAT=csv selects CSV
+void myl1pref_telemetry::dump(const std::string& cache_name, const config_counters_t& counters) {
+    const char* file_name = std::getenv("MYL1PREF_TELEMETRY_FILE");
+    const char* format = std::getenv("MYL1PREF_TELEMETRY_FORMAT");
+    bool csv = format != nullptr && std::string{format} == "csv";
+
+    std::ofstream file;
+    if (file_name != nullptr)
+        file.open(file_name, std::ios::app);
+    std::ostream& out = file.is_open() ? static_cast<std::ostream&>(file) : std::cout;
+
+    if (csv)
+        dump_csv(out, cache_name, counters);
+    else
+        dump_json(out, cache_name, counters);
+
+    // The next dump (next ROI) only covers what happens from now on
+    ring_head = 0;
+    ring_count = 0;
+    dropped_intervals = 0;
+    total = telemetry_interval_t{};
+    roi++;
+}
+
+void myl1pref_telemetry::dump_json(std::ostream& out, const std::string& cache_name, const config_counters_t& counters) const {
+    auto print_array = [&out](const auto& values) {
+        out << "[";
+        for (std::size_t i = 1; i < NUM_PREFETCH_SOURCES; ++i)
+            out << (i > 1 ? "," : "") << values[i];
+        out << "]";
     };
-    print_engine_stats("NL ", num_prefetches_issued_nl,  num_prefetches_useful_nl,  pq_hits_nl_total); // Updated
-    print_engine_stats("DHT", num_prefetches_issued_tdc, num_prefetches_useful_tdc, pq_hits_tdc_total);
-    print_engine_stats("RP", num_prefetches_issued_src, num_prefetches_useful_src, pq_hits_src_total);
-
-    uint64_t total_issued = num_prefetches_issued_nl + num_prefetches_issued_tdc + num_prefetches_issued_src; // Updated
-    uint64_t total_pq_hits = pq_hits_nl_total + pq_hits_tdc_total + pq_hits_src_total; // Updated
-    
-    std::cout << "Overall:" << std::endl;
-    std::cout << "  Total Prefetches Issued: " << total_issued << std::endl;
-    std::cout << "  Total PQ Hits (all engines): " << total_pq_hits << std::endl;
-    if (total_issued > 0) {
-        std::cout << "  Overall PQ Hit Rate: " << std::fixed << std::setprecision(2) << (100.0 * (double)total_pq_hits / (double)total_issued) << "%" << std::endl;
-    } else {
-        std::cout << "  Overall PQ Hit Rate: N/A" << std::endl;
+    auto print_engine_counts = [&](const telemetry_interval_t& interval) {
+        out << "\"issued\":";
+        print_array(interval.issued);
+        out << ",\"useful\":";
+        print_array(interval.useful);
+        out << ",\"late\":";
+        print_array(interval.late);
+    };
+
+    out << "{\"prefetcher\":\"myl1pref\",\"cache\":\"" << cache_name << "\",\"roi\":" << roi
+        << ",\"engines\":[";
+    for (std::size_t i = 1; i < NUM_PREFETCH_SOURCES; ++i)
+        out << (i > 1 ? "," : "") << "\"" << engine_traits::names[i] << "\"";
+    out << "],\"counters\":{";
+    for (std::size_t i = 0; i < counters.size(); ++i)
+        out << (i > 0 ? "," : "") << "\"" << counters[i].first << "\":" << counters[i].second;
+    out << "},\"total\":{";
+    print_engine_counts(total);
+    out << "},\"dropped_intervals\":" << dropped_intervals << ",\"intervals\":[";
+    for (std::size_t n = 0; n < ring_count; ++n) {
+        const telemetry_interval_t& interval = ring[(ring_head + TELEMETRY_RING_SIZE - ring_count + n) % TELEMETRY_RING_SIZE];
+        out << (n > 0 ? "," : "") << "{\"end_cycle\":" << interval.end_cycle
+            << ",\"phase\":\"" << (interval.phase == PHASE_EXPLORE ? "explore" : "exploit") << "\",\"score\":";
+        print_array(interval.score);
+        out << ",\"selected\":";
+        print_array(interval.selected);
+        out << ",";
+        print_engine_counts(interval);
+        out << "}";
     }
-    std::cout << "  Total Useful by ChampSim (any metadata): " << num_prefetches_useful_total_champsim << std::endl;
-    uint64_t total_useful_by_our_engines_champsim = num_prefetches_useful_nl + num_prefetches_useful_tdc + num_prefetches_useful_src; // Updated
-     if (total_issued > 0) {
-        std::cout << "  Overall Accuracy (ChampSim useful from our engines / Issued): " << std::fixed << std::setprecision(2) << (100.0 * (double)total_useful_by_our_engines_champsim / (double)total_issued) << "%" << std::endl;
-    } else {
-        std::cout << "  Overall Accuracy (ChampSim useful from our engines / Issued): N/A" << std::endl;
+    out << "]}" << std::endl;
+}
+
+// Long format: interval and total rows per engine, then one row per counter (same fields as the JSON)
+void myl1pref_telemetry::dump_csv(std::ostream& out, const std::string& cache_name, const config_counters_t& counters) const {
+    const auto& engine_names = engine_traits::names;
+    out << "cache,roi,end_cycle,phase,engine,score,selected,issued,useful,late,counter,value\n";
+    for (std::size_t n = 0; n < ring_count; ++n) {
+        const telemetry_interval_t& interval = ring[(ring_head + TELEMETRY_RING_SIZE - ring_count + n) % TELEMETRY_RING_SIZE];
+        for (std::size_t i = 1; i < NUM_PREFETCH_SOURCES; ++i) {
+            out << cache_name << "," << roi << "," << interval.end_cycle << "," << (interval.phase == PHASE_EXPLORE ? "explore" : "exploit")
+                << "," << engine_names[i] << "," << interval.score[i] << "," << interval.selected[i] << "," << interval.issued[i]
+                << "," << interval.useful[i] << "," << interval.late[i] << ",,\n";
+        }
+    }
+    for (std::size_t i = 1; i < NUM_PREFETCH_SOURCES; ++i) {
+        out << cache_name << "," << roi << ",,total," << engine_names[i] << ",,," << total.issued[i] << "," << total.useful[i]
+            << "," << total.late[i] << ",,\n";
     }
-    std::cout << "------------------------------------" << std::endl;
+    for (const auto& [name, value] : counters)
+        out << cache_name << "," << roi << ",,counter,,,,,,," << name << "," << value << "\n";
+    out << cache_name << "," << roi << ",,counter,,,,,,,dropped_intervals," << dropped_intervals << "\n";
+    out << std::flush;
+}
+#endif
+
+#if MYL1PREF_PROFILER
+profile_counts_t* myl1pref_profiler::find(std::unordered_map<uint64_t, profile_counts_t>& counts, uint64_t key) {
+    auto it = counts.find(key);
+    if (it != counts.end())
+        return &it->second;
+    if (counts.size() >= PROFILER_MAX_ENTRIES) {
+        untracked++;
+        return nullptr;
+    }
+    return &counts[key];
+}
+
+void myl1pref_profiler::record_miss(uint64_t pc, uint64_t block_addr, PrefetchSourceEngine late_engine) {
+    constexpr unsigned page_shift = LOG2_PAGE_SIZE - LOG2_CACHE_LINE_SIZE;
+    for (profile_counts_t* counts : {find(pcs, pc), find(pages, block_addr >> page_shift)}) {
+        if (counts == nullptr)
+            continue;
+        if (late_engine != PrefetchSourceEngine::NONE)
+            counts->late++;
+        else
+            counts->misses++;
+    }
+}
+
+void myl1pref_profiler::record_covered(uint64_t pc, uint64_t block_addr, PrefetchSourceEngine engine) {
+    constexpr unsigned page_shift = LOG2_PAGE_SIZE - LOG2_CACHE_LINE_SIZE;
+    for (profile_counts_t* counts : {find(pcs, pc), find(pages, block_addr >> page_shift)}) {
+        if (counts != nullptr)
+            counts->covered[engine]++;
+    }
+}
+
+void myl1pref_profiler::record_useless(uint64_t block_addr) {
+    constexpr unsigned page_shift = LOG2_PAGE_SIZE - LOG2_CACHE_LINE_SIZE;
+    if (profile_counts_t* counts = find(pages, block_addr >> page_shift))
+        counts->useless++;
+}
+
+// Entries sorted by uncovered misses (missed + late), most first
+void myl1pref_profiler::dump_top(std::ostream& out, const char* key_name, unsigned key_shift,
+                                 const std::unordered_map<uint64_t, profile_counts_t>& counts) {
+    std::vector<std::pair<uint64_t, profile_counts_t>> top(counts.begin(), counts.end());
+    std::size_t n = std::min(PROFILER_TOP_N, top.size());
+    std::partial_sort(top.begin(), top.begin() + n, top.end(),
+                      [](const auto& x, const auto& y) { return x.second.uncovered() > y.second.uncovered(); });
+
+    out << "[";
+    for (std::size_t i = 0; i < n; ++i) {
+        const profile_counts_t& c = top[i].second;
+        out << (i > 0 ? "," : "") << "{\"" << key_name << "\":\"0x" << std::hex << (top[i].first << key_shift) << std::dec
+            << "\",\"misses\":" << c.misses << ",\"late\":" << c.late << ",\"useless\":" << c.useless << ",\"covered\":[";
+        for (std::size_t e = 1; e < NUM_PREFETCH_SOURCES; ++e)
+            out << (e > 1 ? "," : "") << c.covered[e];
+        out << "]}";
+    }
+    out << "]";
+}
+
+// Written to $MYL1PREF_PROFILE_FILE if set (appending), stdout otherwise
+void myl1pref_profiler::dump(const std::string& cache_name) {
+    const char* file_name = std::getenv("MYL1PREF_PROFILE_FILE");
+    std::ofstream file;
+    if (file_name != nullptr)
+        file.open(file_name, std::ios::app);
+    std::ostream& out = file.is_open() ? static_cast<std::ostream&>(file) : std::cout;
+
+    out << "{\"prefetcher\":\"myl1pref\",\"cache\":\"" << cache_name << "\",\"roi\":" << roi << ",\"engines\":[";
+    for (std::size_t i = 1; i < NUM_PREFETCH_SOURCES; ++i)
+        out << (i > 1 ? "," : "") << "\"" << engine_traits::names[i] << "\"";
+    out << "],\"untracked\":" << untracked << ",\"pcs\":";
+    dump_top(out, "pc", 0, pcs);
+    out << ",\"pages\":";
+    dump_top(out, "page", LOG2_PAGE_SIZE, pages);
+    out << "}" << std::endl;
+
+    // The next dump (next ROI) only covers what happens from now on; blocks in the cache stay tracked
+    pcs.clear();
+    pages.clear();
+    untracked = 0;
+    roi++;
 }
+#endif
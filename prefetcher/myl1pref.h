@@ -3,39 +3,121 @@
 
 #include "cache.h"
 #include "modules.h"
+#include "branch_hints.h"
 
 #include <vector>
 #include <cstdint>
 #include <deque>
+#include <array>
+#include <string>
+#include <utility>
+#include <ostream>
+#include <tuple>
+#include <unordered_map>
+#include <algorithm>
+#include <bit>
 
 
-// The queues we use to check hits
-constexpr unsigned MAX_PQ_SIZE = 8;
+// ChampSim uses the same block size at every level
 constexpr unsigned LOG2_CACHE_LINE_SIZE = 6;
+constexpr unsigned LOG2_PAGE_SIZE = 12;
 
-// Delta history tracker
+// Pre-issue filter: prefetches in flight, direct-mapped. Entries are dropped when the block fills
+constexpr unsigned RECENT_REQ_INDEX_BITS = 6;
+constexpr unsigned RECENT_REQ_NUM_ENTRIES = 1 << RECENT_REQ_INDEX_BITS;
+
+// Candidate queue: predictions of all engines wait here and are drained into the PQ by rank
+constexpr unsigned CANDIDATE_QUEUE_SIZE = 32;
+constexpr unsigned CANDIDATE_MAX_AGE_CYCLES = 128; // Older candidates would most likely arrive late
+constexpr int CANDIDATE_CONFIDENT_BONUS = 1024;    // Added to the engine score when the engine fills this level
+constexpr int CANDIDATE_DISTANCE_PENALTY = 64;     // Per position in the engine's prediction, later ones are needed later
+
+// Delta history tracker (table sizes are the L1D defaults, see level_config_t)
 constexpr unsigned DHT_AHT_INDEX_BITS = 9;
-constexpr unsigned DHT_AHT_NUM_ENTRIES = 1 << DHT_AHT_INDEX_BITS;
-constexpr unsigned DHT_AHT_TAG_INITIAL_SHIFT = DHT_AHT_INDEX_BITS;
-constexpr unsigned DHT_AHT_DELTA_HISTORY_SIZE = 3;
+constexpr unsigned DHT_AHT_DELTA_HISTORY_SIZE = 4; // Also the number of PHTs: PHT i matches the i+1 most recent deltas
 constexpr unsigned DHT_PHT_INDEX_BITS = 11;
-constexpr unsigned DHT_PHT_NUM_ENTRIES = 1 << DHT_PHT_INDEX_BITS;
 constexpr unsigned DHT_PHT_CONFIDENCE_MAX = 3;
 
-// Region prefetcher
-constexpr unsigned RP_LINES_PER_REGION_LOG2 = 3;
+// Region prefetcher (spatial footprints, SMS-like)
+// Regions can grow up to a 4KB page (64 lines), so footprints fit in a uint64_t
+constexpr unsigned RP_LINES_PER_REGION_LOG2 = 5;
+static_assert(RP_LINES_PER_REGION_LOG2 <= 12 - LOG2_CACHE_LINE_SIZE, "RP regions can not be larger than a 4KB page");
 constexpr unsigned RP_LINES_PER_REGION = 1 << RP_LINES_PER_REGION_LOG2;
 constexpr unsigned RP_REGION_MASK = RP_LINES_PER_REGION - 1;
+constexpr uint64_t RP_FULL_FOOTPRINT = (RP_LINES_PER_REGION == 64) ? ~0ULL : ((1ULL << RP_LINES_PER_REGION) - 1);
 constexpr unsigned RP_INDEX_BITS = 9;
-constexpr unsigned RP_NUM_SETS = 1 << RP_INDEX_BITS;
 constexpr unsigned RP_NUM_WAYS = 2;
-constexpr unsigned RP_ACCESS_DENSITY_THRESHOLD = 3;
+// Regions without a learned footprint are prefetched whole once a quarter of their lines was touched
+constexpr unsigned RP_ACCESS_DENSITY_THRESHOLD = RP_LINES_PER_REGION / 4;
+static_assert(RP_ACCESS_DENSITY_THRESHOLD >= 2, "A single touched line must not trigger a whole region");
+
+// Pattern history of the region prefetcher, indexed by trigger PC + offset
+constexpr unsigned RP_PHT_INDEX_BITS = 10;
+constexpr unsigned RP_PHT_MIN_FOOTPRINT_LINES = 2; // Footprints with only the trigger line are not worth recording
+
+// Temporal correlation (ISB/Triage-like): replays miss sequences recorded in a bounded history
+constexpr unsigned TC_HISTORY_BITS = 11;
+constexpr unsigned TC_INDEX_BITS = 11;
+constexpr unsigned TC_PREFETCH_DEGREE = 2;
+
+// Branch-guided (B-Fetch-like): blocks accessed after a confident branch prediction, replayed when it is predicted again
+constexpr unsigned BG_INDEX_BITS = 10;
+constexpr unsigned BG_BLOCKS_PER_PATH = 2;
+
+// Lazy aging: entries carry the epoch they were last reconciled in. Every half wrap of the epoch
+// all entries are reconciled (age_all), so an idle entry can never wrap around and look fresh
+constexpr unsigned AGING_EPOCH_BITS = 16;
+constexpr unsigned AGING_EPOCH_MASK = (1 << AGING_EPOCH_BITS) - 1;
+constexpr unsigned AGING_SWEEP_EPOCHS = 1 << (AGING_EPOCH_BITS - 1);
+using aging_epoch_t = uint16_t;
 
 enum PrefetchSourceEngine {
   NONE = 0, 
   NL  = 1,
   DHT = 2,
-  RP = 3
+  RP = 3,
+  TC = 4,
+  BG = 5
+};
+
+enum class PrefetcherLevel {
+  L1D,
+  L2C,
+  LLC
+};
+
+constexpr uint32_t access_type_bit(access_type type) { return 1u << static_cast<unsigned>(type); }
+
+// Table sizes and training policy of each cache level, picked from the name given to the cache in the JSON config
+struct level_config_t {
+  unsigned aht_index_bits;
+  unsigned pht_index_bits;
+  unsigned rp_index_bits;
+  unsigned rp_pht_index_bits;
+  unsigned tc_history_bits;
+  unsigned tc_index_bits;
+  uint32_t train_access_types;    // Mask of access_type_bit() values the engines train on
+  bool train_on_misses_only;      // Misses and hits on prefetched lines, i.e. the miss stream of the level above
+  bool low_confidence_fill_lower; // Low-confidence prefetches fill the next level only, keeping this one clean
+  bool branch_hints;              // Consume the core's branch predictor hints, one consumer per core
+};
+
+constexpr level_config_t L1D_LEVEL_CONFIG = {DHT_AHT_INDEX_BITS, DHT_PHT_INDEX_BITS, RP_INDEX_BITS, RP_PHT_INDEX_BITS, TC_HISTORY_BITS, TC_INDEX_BITS,
+                                             access_type_bit(access_type::LOAD), false, true, true};
+constexpr level_config_t L2C_LEVEL_CONFIG = {10, 12, 10, 11, 12, 12,
+                                             access_type_bit(access_type::LOAD) | access_type_bit(access_type::RFO) | access_type_bit(access_type::PREFETCH),
+                                             true, true, false};
+constexpr level_config_t LLC_LEVEL_CONFIG = {11, 13, 11, 12, 13, 13,
+                                             access_type_bit(access_type::LOAD) | access_type_bit(access_type::RFO) | access_type_bit(access_type::PREFETCH),
+                                             true, false, false};
+
+// Run-time knobs: the table sizes and training rules of the level, and the phase and aging durations.
+// prefetcher_initialize() uses the defaults of the cache level; tools that sweep them call initialize_with()
+struct myl1pref_tuning_t {
+  level_config_t level_config;
+  uint64_t explore_duration_cycles = 256000;
+  uint64_t exploit_duration_cycles = 256000 * 3;
+  uint64_t aging_interval_cycles = 256000;
 };
 
 enum PrefetcherPhase {
@@ -43,141 +125,602 @@ enum PrefetcherPhase {
   PHASE_EXPLOIT
 };
 
+// Tables are stored as struct-of-arrays. Tags (and the TC/BG index keys) are packed with
+// their valid bit into a single key, so a lookup is a single compare. Delta histories carry no valid bit
+constexpr uint64_t KEY_VALID_BIT = 1ULL << 63;
+constexpr uint32_t TAG_VALID_BIT = 1U << 31;
+
+// Delta histories are packed in a 64-bit key, most recent delta in the low bits.
+// A 0 delta is never recorded, so it marks the part of the history that is not filled yet:
+// PHT keys need no valid bit, an empty entry (key 0) never matches a usable history
+constexpr unsigned DHT_DELTA_BITS = 16;
+static_assert(DHT_DELTA_BITS * DHT_AHT_DELTA_HISTORY_SIZE <= 64, "The delta history must fit in a 64-bit key");
+
+// Deltas that do not fit in DHT_DELTA_BITS are recorded as this value instead of wrapping:
+// it is never predicted and histories that contain it are not used
+constexpr int16_t DHT_DELTA_OUT_OF_RANGE = INT16_MIN;
+
+inline int16_t get_history_delta(uint64_t history_key, unsigned i) {
+  return static_cast<int16_t>(history_key >> (i * DHT_DELTA_BITS));
+}
+
+constexpr uint64_t get_history_mask(unsigned length) {
+  return (length * DHT_DELTA_BITS >= 64) ? ~0ULL : (1ULL << (length * DHT_DELTA_BITS)) - 1;
+}
+constexpr uint64_t DHT_HISTORY_KEY_MASK = get_history_mask(DHT_AHT_DELTA_HISTORY_SIZE);
+
+inline int16_t clamp_delta(int64_t delta) {
+  if (delta <= DHT_DELTA_OUT_OF_RANGE || delta > INT16_MAX)
+    return DHT_DELTA_OUT_OF_RANGE;
+  return static_cast<int16_t>(delta);
+}
+
+// The length most recent deltas are all known and in range
+inline bool history_is_usable(uint64_t history_key, unsigned length) {
+  for (unsigned i = 0; i < length; ++i) {
+    int16_t delta = get_history_delta(history_key, i);
+    if (delta == 0 || delta == DHT_DELTA_OUT_OF_RANGE)
+      return false;
+  }
+  return true;
+}
+
+struct DHT_AHT_table_t {
+  std::vector<uint32_t> tag_key; // 16-bit tag | TAG_VALID_BIT
+  std::vector<uint64_t> last_accessed_block;
+  std::vector<uint64_t> delta_history;
+  std::vector<uint8_t> prediction_length; // PHT (history length) of the last prediction for this PC, 0 if none
+  std::vector<int16_t> predicted_delta;
+
+  void resize(std::size_t num_entries) {
+    tag_key.assign(num_entries, 0);
+    last_accessed_block.assign(num_entries, 0);
+    delta_history.assign(num_entries, 0);
+    prediction_length.assign(num_entries, 0);
+    predicted_delta.assign(num_entries, 0);
+  }
+  std::size_t size() const { return tag_key.size(); }
+
+  void record_new_delta(uint32_t idx, int16_t nd) {
+    delta_history[idx] = ((delta_history[idx] << DHT_DELTA_BITS) | static_cast<uint16_t>(nd)) & DHT_HISTORY_KEY_MASK;
+  }
+  void reset(uint32_t idx) {
+    tag_key[idx] = 0;
+    last_accessed_block[idx] = 0;
+    delta_history[idx] = 0;
+    prediction_length[idx] = 0;
+    predicted_delta[idx] = 0;
+  }
+};
+
+struct DHT_PHT_table_t {
+  std::vector<uint64_t> history_key; // Delta history the entry was trained with, cut to the table length
+  std::vector<int16_t> predicted_next_delta;
+  std::vector<uint8_t> confidence;
+  std::vector<aging_epoch_t> epoch;
+
+  void resize(std::size_t num_entries) {
+    history_key.assign(num_entries, 0);
+    predicted_next_delta.assign(num_entries, 0);
+    confidence.assign(num_entries, 0);
+    epoch.assign(num_entries, 0);
+  }
+  std::size_t size() const { return history_key.size(); }
+};
 
-//
-struct DHT_AHT_entry_t {
-  uint16_t tag : 16;
-  uint64_t last_accessed_block : 48;
-  std::array<int16_t, DHT_AHT_DELTA_HISTORY_SIZE> delta_history;
-  bool valid : 1;
+// A whole set lives in one cache line
+struct alignas(64) RP_set_t {
+  std::array<uint64_t, RP_NUM_WAYS> tag_key{};           // 40-bit region tag | KEY_VALID_BIT
+  std::array<uint64_t, RP_NUM_WAYS> access_bitmap{};
+  std::array<uint64_t, RP_NUM_WAYS> prefetch_bitmap{};
+  std::array<uint32_t, RP_NUM_WAYS> pattern_signature{}; // Trigger PC + offset, used to record the footprint on eviction
+  std::array<aging_epoch_t, RP_NUM_WAYS> epoch{};
+  uint8_t lru_way = 0;
 
-  DHT_AHT_entry_t() :
-    tag(0),
-    last_accessed_block(0),
-    valid(false) {
-    delta_history.fill(0);
+  void reset(unsigned way) {
+    tag_key[way] = 0;
+    access_bitmap[way] = 0;
+    prefetch_bitmap[way] = 0;
+    pattern_signature[way] = 0;
+    epoch[way] = 0;
   }
+};
+static_assert(RP_NUM_WAYS != 2 || sizeof(RP_set_t) == 64, "A 2-way RP set should fill exactly one cache line");
+
+struct RP_PHT_table_t {
+  std::vector<uint32_t> tag_key; // 14-bit tag | TAG_VALID_BIT
+  std::vector<uint64_t> footprint;
+
+  void resize(std::size_t num_entries) {
+    tag_key.assign(num_entries, 0);
+    footprint.assign(num_entries, 0);
+  }
+  std::size_t size() const { return tag_key.size(); }
+};
+
+// Miss history in a circular buffer; the index table maps a block to its last position in the history
+struct TC_table_t {
+  std::vector<uint64_t> history;
+  uint64_t history_head = 0; // Total number of misses recorded, the buffer position is this modulo its size
+  std::vector<uint64_t> index_key; // Block | KEY_VALID_BIT
+  std::vector<uint64_t> index_position;
+
+  void resize(std::size_t history_entries, std::size_t index_entries) {
+    history.assign(history_entries, 0);
+    history_head = 0;
+    index_key.assign(index_entries, 0);
+    index_position.assign(index_entries, 0);
+  }
+};
+
+// Paths are keyed by the predicted branch and its direction, deltas are relative to the access the hint arrived with
+struct BG_table_t {
+  std::vector<uint64_t> path_key; // Branch IP, taken bit | KEY_VALID_BIT
+  std::vector<int16_t> deltas;    // BG_BLOCKS_PER_PATH per entry, 0 when not recorded
+
+  void resize(std::size_t num_entries) {
+    path_key.assign(num_entries, 0);
+    deltas.assign(num_entries * BG_BLOCKS_PER_PATH, 0);
+  }
+  std::size_t size() const { return path_key.size(); }
+};
+
+// Everything the engines see about the access they train on
+struct prefetch_access_t {
+  uint64_t block_addr;
+  uint64_t pc;
+  bool has_pc;
+  bool cache_hit;
+  bool useful_prefetch;
+};
+
+using config_counters_t = std::vector<std::pair<std::string, uint64_t>>;
+
+// Engines are plugged in at compile time through myl1pref_engines. Each one provides:
+//   id, name, selection_priority (lowest wins score ties) and pq_hit_reward
+//   initialize(level_config)    sizes its tables for the cache level
+//   train(access, aging_epoch)  updates its tables and prepares its prediction for the access
+//   age_all(aging_epoch)        reconciles every entry with the epoch, called every AGING_SWEEP_EPOCHS
+//   predict(access, issue)      calls issue(block, trigger_block, fill_this_level) per candidate, most timely first,
+//                               and stops when it returns false (issue only queues the candidate)
+//   prefetch_issued(block)      called when one of its candidates actually reached the PQ
+//   report_config(counters)     appends its parameters and its own counters to the final stats
+
+struct nl_engine {
+  static constexpr PrefetchSourceEngine id = PrefetchSourceEngine::NL;
+  static constexpr const char* name = "NL";
+  static constexpr unsigned selection_priority = 3;
+  static constexpr int pq_hit_reward = 1;
+
+  unsigned degree = 1;
+
+  void initialize(const level_config_t&) {}
+  void train(const prefetch_access_t&, aging_epoch_t) {}
+  void age_all(aging_epoch_t) {}
+  void prefetch_issued(uint64_t) {}
+  void report_config(config_counters_t& counters) const { counters.emplace_back("nl_prefetch_degree", degree); }
+
+  template <typename IssueFn>
+  void predict(const prefetch_access_t& access, IssueFn&& issue) {
+    for (unsigned i = 1; i <= degree; ++i)
+      if (!issue(access.block_addr + i, access.block_addr, true))
+        break;
+  }
+};
+
+class dht_engine {
+  DHT_AHT_table_t AHT_table;
+  std::array<DHT_PHT_table_t, DHT_AHT_DELTA_HISTORY_SIZE> PHT_tables; // VLDP-like, indexed by history length - 1
+  level_config_t level_config{};
+  aging_epoch_t aging_epoch = 0;
+  std::array<uint64_t, DHT_AHT_DELTA_HISTORY_SIZE> pht_predictions{}; // Predictions made by each PHT
+  std::array<uint64_t, DHT_AHT_DELTA_HISTORY_SIZE> pht_hits{};        // Of those, confirmed by the next delta of the PC
+
+  // Prediction prepared by train()
+  bool wants_to_prefetch = false;
+  bool fill_this_level = false;
+  int16_t predicted_delta = 0;
+
+  uint32_t get_aht_index(uint64_t pc) const;
+  uint16_t get_aht_tag(uint64_t pc) const;
+  uint32_t get_pht_index(uint64_t history_key, unsigned length) const;
+  void age_pht_entry(DHT_PHT_table_t& table, uint32_t pht_idx);
+  void train_pht(DHT_PHT_table_t& table, uint64_t history_key, unsigned length, int16_t current_delta);
+
+public:
+  static constexpr PrefetchSourceEngine id = PrefetchSourceEngine::DHT;
+  static constexpr const char* name = "DHT";
+  static constexpr unsigned selection_priority = 0;
+  static constexpr int pq_hit_reward = 1;
+
+  void initialize(const level_config_t& config);
+  void train(const prefetch_access_t& access, aging_epoch_t current_epoch);
+  void age_all(aging_epoch_t current_epoch);
+  void prefetch_issued(uint64_t) {}
+  void report_config(config_counters_t& counters) const;
+
+  template <typename IssueFn>
+  void predict(const prefetch_access_t& access, IssueFn&& issue) {
+    if (wants_to_prefetch)
+      issue(access.block_addr + static_cast<int64_t>(predicted_delta), access.block_addr, fill_this_level);
+  }
+};
+
+class rp_engine {
+  std::vector<RP_set_t> RP_table;
+  RP_PHT_table_t RP_PHT_table;
+  level_config_t level_config{};
+  aging_epoch_t aging_epoch = 0;
 
-  void record_new_delta(int16_t nd) {
-    for (int i = DHT_AHT_DELTA_HISTORY_SIZE - 1; i > 0; i--)
-      delta_history[i] = delta_history[i-1];
-    delta_history[0] = nd;
+  // Prediction prepared by train()
+  RP_set_t* set = nullptr;
+  unsigned way = 0;
+  uint64_t region_addr = 0;
+  uint64_t candidate_bitmap = 0;
+  bool fill_this_level = false;
+
+  uint64_t get_region_address(uint64_t block_addr) const;
+  uint8_t get_offset_in_region(uint64_t block_addr) const;
+  uint32_t get_set_index(uint64_t region_addr) const;
+  uint64_t get_tag(uint64_t region_addr) const;
+  uint8_t find_victim(const RP_set_t& set) const;
+  void update_lru(RP_set_t& set, bool accessed_way);
+  uint32_t get_pattern_signature(uint64_t pc, uint8_t offset_in_region) const;
+  void record_footprint(const RP_set_t& set, unsigned way);
+  uint64_t lookup_footprint(uint32_t pattern_signature) const;
+  void age_entry(RP_set_t& set, unsigned way) const;
+
+public:
+  static constexpr PrefetchSourceEngine id = PrefetchSourceEngine::RP;
+  static constexpr const char* name = "RP";
+  static constexpr unsigned selection_priority = 2;
+  static constexpr int pq_hit_reward = 1;
+
+  void initialize(const level_config_t& config);
+  void train(const prefetch_access_t& access, aging_epoch_t current_epoch);
+  void age_all(aging_epoch_t current_epoch);
+  void prefetch_issued(uint64_t block_addr);
+  void report_config(config_counters_t& counters) const;
+
+  template <typename IssueFn>
+  void predict(const prefetch_access_t&, IssueFn&& issue) {
+    uint64_t base_region_b_addr = region_addr << RP_LINES_PER_REGION_LOG2;
+    uint64_t pending = candidate_bitmap & ~set->access_bitmap[way] & ~set->prefetch_bitmap[way];
+    while (pending != 0) {
+      unsigned i = static_cast<unsigned>(std::countr_zero(pending));
+      pending &= pending - 1;
+      if (!issue(base_region_b_addr + i, base_region_b_addr, fill_this_level))
+        break;
+    }
   }
-  void reset() {
-    last_accessed_block = 0;
-    tag = 0;
-    valid = false;
-    delta_history.fill(0);
+};
+
+class tc_engine {
+  TC_table_t TC_table;
+  level_config_t level_config{};
+
+  // Prediction prepared by train(): history positions that followed the previous occurrence of the block
+  uint64_t successors_start = 0;
+  uint64_t successors_end = 0;
+
+  uint32_t get_index(uint64_t block_addr) const;
+
+public:
+  static constexpr PrefetchSourceEngine id = PrefetchSourceEngine::TC;
+  static constexpr const char* name = "TC";
+  static constexpr unsigned selection_priority = 1;
+  static constexpr int pq_hit_reward = 1;
+
+  void initialize(const level_config_t& config);
+  void train(const prefetch_access_t& access, aging_epoch_t current_epoch);
+  void age_all(aging_epoch_t) {}
+  void prefetch_issued(uint64_t) {}
+  void report_config(config_counters_t& counters) const;
+
+  template <typename IssueFn>
+  void predict(const prefetch_access_t& access, IssueFn&& issue) {
+    uint64_t history_size = TC_table.history.size();
+    for (uint64_t pos = successors_start; pos < successors_end; ++pos) {
+      uint64_t block_addr_to_prefetch = TC_table.history[pos % history_size];
+      if (block_addr_to_prefetch == access.block_addr)
+        continue;
+      // Recorded addresses are real miss addresses, so crossing a page is fine: the target is its own trigger
+      bool fill_this_level = !level_config.low_confidence_fill_lower || pos == successors_start;
+      if (!issue(block_addr_to_prefetch, block_addr_to_prefetch, fill_this_level))
+        break;
+    }
   }
 };
 
-struct DHT_PHT_entry_t {
-  std::array<int16_t, DHT_AHT_DELTA_HISTORY_SIZE> tag_delta_history; // Same size of delta history as AHT
-  int16_t predicted_next_delta : 10;
-  uint8_t confidence : 2;
-  bool valid : 1;
+class bg_engine {
+  BG_table_t BG_table;
+  level_config_t level_config{};
+  branch_hint_ring* hints = nullptr;
+  uint64_t hints_consumed = 0;
+
+  // Path being recorded: the entry of the last hint and the access it arrived with
+  uint32_t recording_idx = 0;
+  unsigned recorded_blocks = BG_BLOCKS_PER_PATH;
+  uint64_t anchor_block = 0;
+
+  // Prediction prepared by train(): the entry of the hint consumed with this access, if any
+  bool wants_to_prefetch = false;
+  uint32_t predicted_idx = 0;
+
+  uint32_t get_index(uint64_t path_key) const;
+
+public:
+  static constexpr PrefetchSourceEngine id = PrefetchSourceEngine::BG;
+  static constexpr const char* name = "BG";
+  static constexpr unsigned selection_priority = 4;
+  static constexpr int pq_hit_reward = 1;
+
+  void initialize(const level_config_t& config);
+  void attach(branch_hint_ring& ring) { hints = &ring; }
+  void train(const prefetch_access_t& access, aging_epoch_t current_epoch);
+  void age_all(aging_epoch_t) {}
+  void prefetch_issued(uint64_t) {}
+  void report_config(config_counters_t& counters) const;
 
-  DHT_PHT_entry_t() :
-    predicted_next_delta(0),
-    confidence(0),
-    valid(false) {
-    tag_delta_history.fill(0);
+  template <typename IssueFn>
+  void predict(const prefetch_access_t& access, IssueFn&& issue) {
+    if (!wants_to_prefetch)
+      return;
+    for (unsigned i = 0; i < BG_BLOCKS_PER_PATH; ++i) {
+      int16_t delta = BG_table.deltas[predicted_idx * BG_BLOCKS_PER_PATH + i];
+      if (delta == 0)
+        break;
+      // Only a prediction of the path ahead: keep it out of this level unless the level wants everything
+      if (!issue(access.block_addr + static_cast<int64_t>(delta), access.block_addr, !level_config.low_confidence_fill_lower))
+        break;
+    }
   }
-  void reset() {
-    predicted_next_delta = 0;
-    confidence = 0;
-    valid = false;
-    tag_delta_history.fill(0);
+};
+
+// Engines in issue order; their ids must follow this order
+using myl1pref_engines = std::tuple<nl_engine, dht_engine, rp_engine, tc_engine, bg_engine>;
+
+template <typename Engines>
+struct engine_list_traits;
+
+template <typename... Engines>
+struct engine_list_traits<std::tuple<Engines...>> {
+  static constexpr std::size_t size = sizeof...(Engines);
+  static constexpr std::array<const char*, size + 1> names = {"NONE", Engines::name...};
+  static constexpr std::array<int, size + 1> pq_hit_reward = {0, Engines::pq_hit_reward...};
+
+  // Engine ids sorted by selection_priority
+  static constexpr std::array<PrefetchSourceEngine, size> selection_order = [] {
+    std::array<std::pair<unsigned, PrefetchSourceEngine>, size> order = {std::pair{Engines::selection_priority, Engines::id}...};
+    std::sort(order.begin(), order.end());
+    std::array<PrefetchSourceEngine, size> ids{};
+    for (std::size_t i = 0; i < size; ++i)
+      ids[i] = order[i].second;
+    return ids;
+  }();
+
+  static constexpr bool ids_follow_order() {
+    std::size_t expected = 0;
+    return ((static_cast<std::size_t>(Engines::id) == ++expected) && ...);
   }
 };
 
-struct RP_entry_t {
-  uint64_t region_address_tag : 40;
-  uint8_t access_bitmap : 8;
-  uint8_t prefetch_bitmap : 8;
-  bool valid : 1;
+using engine_traits = engine_list_traits<myl1pref_engines>;
+static_assert(engine_traits::ids_follow_order(), "Engine ids must be 1, 2, ... in the order of myl1pref_engines");
 
-  RP_entry_t() :
-    region_address_tag(0),
-    access_bitmap(0),
-    prefetch_bitmap(0),
-    valid(false) {}
-  void reset() {
-    region_address_tag = 0;
-    access_bitmap = 0;
-    prefetch_bitmap = 0;
-    valid = false;
+// Telemetry: compile with -DMYL1PREF_TELEMETRY=0 to remove it completely
+#ifndef MYL1PREF_TELEMETRY
+#define MYL1PREF_TELEMETRY 1
+#endif
+
+constexpr std::size_t NUM_PREFETCH_SOURCES = engine_traits::size + 1; // Indexed by PrefetchSourceEngine, 0 is NONE
+constexpr std::size_t TELEMETRY_RING_SIZE = 1024;
+
+// Per-engine counts of one EXPLORE or EXPLOIT interval
+struct telemetry_interval_t {
+  uint64_t end_cycle = 0;
+  PrefetcherPhase phase = PHASE_EXPLORE; // Phase that ended with this interval
+  std::array<int, NUM_PREFETCH_SOURCES> score{};
+  std::array<bool, NUM_PREFETCH_SOURCES> selected{};
+  std::array<uint64_t, NUM_PREFETCH_SOURCES> issued{};
+  std::array<uint64_t, NUM_PREFETCH_SOURCES> useful{};
+  std::array<uint64_t, NUM_PREFETCH_SOURCES> late{};
+};
+
+#if MYL1PREF_TELEMETRY
+class myl1pref_telemetry {
+  std::vector<telemetry_interval_t> ring = std::vector<telemetry_interval_t>(TELEMETRY_RING_SIZE);
+  std::size_t ring_head = 0;
+  std::size_t ring_count = 0;
+  uint64_t dropped_intervals = 0;
+  unsigned roi = 0;
+
+  telemetry_interval_t current{};
+  telemetry_interval_t total{};
+
+  void dump_json(std::ostream& out, const std::string& cache_name, const config_counters_t& counters) const;
+  void dump_csv(std::ostream& out, const std::string& cache_name, const config_counters_t& counters) const;
+
+public:
+  void count_issued(PrefetchSourceEngine engine) { current.issued[engine]++; total.issued[engine]++; }
+  void count_useful(PrefetchSourceEngine engine) { current.useful[engine]++; total.useful[engine]++; }
+  void count_late(PrefetchSourceEngine engine) { current.late[engine]++; total.late[engine]++; }
+
+  void close_interval(uint64_t cycle, PrefetcherPhase phase, const std::array<int, NUM_PREFETCH_SOURCES>& score,
+                      const std::array<bool, NUM_PREFETCH_SOURCES>& selected);
+  void dump(const std::string& cache_name, const config_counters_t& counters);
+};
+#else
+class myl1pref_telemetry {
+public:
+  void count_issued(PrefetchSourceEngine) {}
+  void count_useful(PrefetchSourceEngine) {}
+  void count_late(PrefetchSourceEngine) {}
+  void close_interval(uint64_t, PrefetcherPhase, const std::array<int, NUM_PREFETCH_SOURCES>&, const std::array<bool, NUM_PREFETCH_SOURCES>&) {}
+  void dump(const std::string&, const config_counters_t&) {}
+};
+#endif
+
+// Profiler: where demand misses come from, per load PC and per 4KB page. Off by default,
+// compile with -DMYL1PREF_PROFILER=1 to enable it
+#ifndef MYL1PREF_PROFILER
+#define MYL1PREF_PROFILER 0
+#endif
+
+constexpr std::size_t PROFILER_MAX_ENTRIES = 1 << 16; // Per map; accesses to keys past this are only counted as untracked
+constexpr std::size_t PROFILER_TOP_N = 16;
+
+struct profile_counts_t {
+  uint32_t misses = 0;  // Demand misses no prefetch was issued for
+  uint32_t late = 0;    // Demand misses on a block whose prefetch was still in flight
+  uint32_t useless = 0; // Prefetched blocks evicted before any use (pages only, fills carry no PC)
+  std::array<uint32_t, NUM_PREFETCH_SOURCES> covered{}; // Demand hits (any access type but prefetch) on prefetched blocks, by engine
+
+  uint32_t uncovered() const { return misses + late; }
+};
+
+#if MYL1PREF_PROFILER
+class myl1pref_profiler {
+  std::unordered_map<uint64_t, profile_counts_t> pcs;
+  std::unordered_map<uint64_t, profile_counts_t> pages;
+  uint64_t untracked = 0;
+  unsigned roi = 0;
+
+  profile_counts_t* find(std::unordered_map<uint64_t, profile_counts_t>& counts, uint64_t key);
+  static void dump_top(std::ostream& out, const char* key_name, unsigned key_shift, const std::unordered_map<uint64_t, profile_counts_t>& counts);
+
+public:
+  void record_miss(uint64_t pc, uint64_t block_addr, PrefetchSourceEngine late_engine);
+  void record_covered(uint64_t pc, uint64_t block_addr, PrefetchSourceEngine engine);
+  void record_useless(uint64_t block_addr);
+  void dump(const std::string& cache_name);
+};
+#else
+class myl1pref_profiler {
+public:
+  void record_miss(uint64_t, uint64_t, PrefetchSourceEngine) {}
+  void record_covered(uint64_t, uint64_t, PrefetchSourceEngine) {}
+  void record_useless(uint64_t) {}
+  void dump(const std::string&) {}
+};
+#endif
+
+// Blocks our prefetches filled that no access used yet, with the engine from the fill metadata.
+// Only the telemetry and the profiler read it: compiled out when both are
+#if MYL1PREF_TELEMETRY || MYL1PREF_PROFILER
+class myl1pref_unused_prefetches {
+  std::unordered_map<uint64_t, uint8_t> blocks;
+
+public:
+  void clear() { blocks.clear(); }
+  void filled(uint64_t block_addr, PrefetchSourceEngine engine) { blocks[block_addr] = static_cast<uint8_t>(engine); }
+  // Engine whose prefetch filled the block if it was still unused, NONE otherwise. The block is no longer tracked
+  PrefetchSourceEngine take(uint64_t block_addr) {
+    auto it = blocks.find(block_addr);
+    if (it == blocks.end())
+      return PrefetchSourceEngine::NONE;
+    auto engine = static_cast<PrefetchSourceEngine>(it->second);
+    blocks.erase(it);
+    return engine;
   }
 };
+#else
+class myl1pref_unused_prefetches {
+public:
+  void clear() {}
+  void filled(uint64_t, PrefetchSourceEngine) {}
+  PrefetchSourceEngine take(uint64_t) { return PrefetchSourceEngine::NONE; }
+};
+#endif
 
 class myl1pref : public champsim::modules::prefetcher {
 private:
-  std::vector<DHT_AHT_entry_t> AHT_table;
-  std::vector<DHT_PHT_entry_t> PHT_table;
-  std::vector<std::vector<RP_entry_t>> RP_table;
-  std::vector<bool> src_lru_way;
+  myl1pref_engines engines;
+
+  // Generic per-engine bookkeeping, indexed by engine id
+  struct engine_state_t {
+    bool allowed = false;
+    int score = 0;
+    std::deque<uint64_t> recent_prefetches;
+    uint64_t issued = 0;
+    uint64_t useful = 0;
+    uint64_t pq_hits = 0;
+  };
+  std::array<engine_state_t, NUM_PREFETCH_SOURCES> engine_state;
+
+  struct prefetch_candidate_t {
+    uint64_t block_addr;
+    PrefetchSourceEngine engine_id;
+    bool fill_this_level;
+    int rank;
+    uint64_t enqueue_cycle;
+  };
+  std::vector<prefetch_candidate_t> candidate_queue;
+
+  PrefetcherLevel level;
+  level_config_t level_config;
+  std::size_t pq_size;
+  std::vector<uint64_t> recent_request_table;
+  std::vector<uint8_t> recent_request_engine;
+  std::vector<uint8_t> recent_request_this_level; // 0: the prefetch fills the next level only
+  myl1pref_unused_prefetches unused_prefetches;
+  bool drop_cross_page_prefetches; // Physical addresses can not cross pages, virtual ones are only flagged
 
   PrefetcherPhase current_phase; // bit to track which stage are we on
   uint64_t phase_cycle_counter;
   uint64_t explore_duration_cycles;
   uint64_t exploit_duration_cycles;
 
-  bool allowed_nl;
-  bool allowed_tdc;
-  bool allowed_src;
-
+  aging_epoch_t aging_epoch;
+  uint64_t aging_cycle_counter;
+  uint64_t aging_interval_cycles;
 
-  std::deque<uint64_t> recent_prefetches_nl;
-  std::deque<uint64_t> recent_prefetches_tdc;
-  std::deque<uint64_t> recent_prefetches_src;
   static const size_t MAX_RECENT_PF_TRACKING = 16; 
 
-  int score_nl;
-  int score_tdc;
-  int score_src;
-
-  static const int SCORE_MAX_PQ_HIT = 2048; 
+  static constexpr int SCORE_MAX_PQ_HIT = 2048; // constexpr: std::min takes it by reference
   static const int SCORE_THRESHOLD_PREFETCHER = 1024;
 
-  static const int PQ_HIT_REWARD_NL  = 1;
-  static const int PQ_HIT_REWARD_DHT = 1;
-  static const int PQ_HIT_REWARD_RP = 1;
+  PrefetcherLevel detect_level() const;
+  std::size_t detect_cpu() const;
 
-  uint32_t get_aht_index(uint64_t pc) const;
-  uint16_t get_aht_tag(uint64_t pc) const;
-  uint32_t get_pht_index(const std::array<int16_t, DHT_AHT_DELTA_HISTORY_SIZE>& delta_hist) const;
-  uint64_t get_src_region_address(uint64_t block_addr) const;
-  uint8_t get_src_offset_in_region(uint64_t block_addr) const;
-  uint32_t get_src_set_index(uint64_t region_addr) const;
-  uint64_t get_src_tag(uint64_t region_addr) const;
-  uint8_t find_src_victim(uint32_t set_idx) const;
-  void update_src_lru(uint32_t set_idx, bool accessed_way);
+  template <typename Engine>
+  void issue_engine_prefetches(Engine& engine, const prefetch_access_t& access);
 
   void manage_phase_transitions();
   void determine_best_engine_for_exploit();
+  void close_telemetry_interval(PrefetcherPhase phase);
   void reset_scores_and_pq_tracking(); 
   void track_issued_prefetch(PrefetchSourceEngine engine_id, uint64_t block_address);
   void check_pq_hits(uint64_t demand_block_address);
-  bool issue_prefetch_wrapper(uint64_t prefetch_address, PrefetchSourceEngine engine_id);
-
-  uint64_t num_prefetches_issued_nl;
-  uint64_t num_prefetches_useful_nl;
-  uint64_t num_prefetches_issued_tdc;
-  uint64_t num_prefetches_useful_tdc;
-  uint64_t num_prefetches_issued_src;
-  uint64_t num_prefetches_useful_src;
+  uint32_t get_recent_request_index(uint64_t block_addr) const;
+  bool recently_requested(uint64_t block_addr, bool fill_this_level) const;
+  bool filter_prefetch(uint64_t prefetch_block_addr, uint64_t trigger_block_addr, bool fill_this_level);
+  bool enqueue_candidate(uint64_t prefetch_block_addr, uint64_t trigger_block_addr, PrefetchSourceEngine engine_id, bool fill_this_level, unsigned distance);
+  void drop_demanded_candidate(uint64_t demand_block_addr);
+  void drain_candidate_queue();
+  bool issue_prefetch_wrapper(uint64_t prefetch_address, PrefetchSourceEngine engine_id, bool fill_this_level);
+
   uint64_t num_prefetches_useful_total_champsim; 
-  uint64_t pq_hits_nl_total;
-  uint64_t pq_hits_tdc_total;
-  uint64_t pq_hits_src_total;
+  uint64_t num_filtered_cross_page;
+  uint64_t num_flagged_cross_page;
+  uint64_t num_filtered_duplicate;
+  uint64_t num_candidates_merged;
+  uint64_t num_candidates_evicted;
+  uint64_t num_candidates_stale;
+  uint64_t num_candidates_demanded;
 
-  unsigned nl_prefetch_degree;
+  myl1pref_telemetry telemetry;
+  myl1pref_profiler profiler;
+  uint64_t current_cycle() const;
+  PrefetchSourceEngine find_recent_request(uint64_t block_addr) const;
 
 public:
   using champsim::modules::prefetcher::prefetcher;
 
   void prefetcher_initialize();
   void prefetcher_cycle_operate();
+  myl1pref_tuning_t default_tuning() const; // Of the level the cache name gives
+  void initialize_with(const myl1pref_tuning_t& tuning); // prefetcher_initialize() with other knobs
   void prefetcher_final_stats();
   uint32_t prefetcher_cache_operate(champsim::address addr, champsim::address ip, bool cache_hit, bool useful_prefetch, access_type type, uint32_t metadata_in);
   uint32_t prefetcher_cache_fill(champsim::address addr, uint32_t set, uint32_t way, bool prefetch, champsim::address evicted_address, uint32_t metadata_in);
@@ -0,0 +1,100 @@
+#include "cache.h"
+
+CACHE::CACHE(const cache_model_config_t& model_config, bool record)
+    : config(model_config), blocks(model_config.sets * model_config.ways), record_prefetches(record),
+      NAME(model_config.name), virtual_prefetch(model_config.virtual_prefetch) {}
+
+CACHE::block_t* CACHE::find_block(uint64_t block_addr) {
+    block_t* set = &blocks[get_set(block_addr) * config.ways];
+    for (std::size_t way = 0; way < config.ways; ++way)
+        if (set[way].valid && set[way].block_addr == block_addr)
+            return &set[way];
+    return nullptr;
+}
+
+CACHE::miss_t* CACHE::find_miss(uint64_t block_addr) {
+    auto it = std::find_if(misses.begin(), misses.end(), [block_addr](const miss_t& m) { return m.block_addr == block_addr; });
+    return it != misses.end() ? &*it : nullptr;
+}
+
+bool CACHE::prefetch_line(champsim::address pf_addr, bool fill_this_level, uint32_t prefetch_metadata) {
+    if (pq.size() >= config.pq_size)
+        return false;
+
+    uint64_t block_addr = pf_addr.to<uint64_t>() >> CACHE_LOG2_BLOCK_SIZE;
+    pq.push_back({block_addr, prefetch_metadata, fill_this_level});
+    if (fill_this_level)
+        usage_of(prefetch_metadata).issued++;
+    else
+        usage_of(prefetch_metadata).issued_lower++;
+    if (record_prefetches)
+        prefetches.push_back({cycle, demand_accesses, block_addr, fill_this_level, prefetch_metadata});
+    return true;
+}
+
+demand_result_t CACHE::demand_access(uint64_t address) {
+    uint64_t block_addr = address >> CACHE_LOG2_BLOCK_SIZE;
+    demand_accesses++;
+
+    if (block_t* block = find_block(block_addr)) {
+        demand_hits++;
+        block->last_used = cycle;
+        bool useful = block->prefetched;
+        if (useful) {
+            usage_of(block->metadata).useful++;
+            block->prefetched = false;
+        }
+        return {true, useful};
+    }
+
+    // A demand merging with an in-flight prefetch takes it over, the fill is not a prefetch anymore
+    if (miss_t* miss = find_miss(block_addr)) {
+        if (miss->prefetch) {
+            usage_of(miss->metadata).late++;
+            miss->prefetch = false;
+        }
+    } else {
+        misses.push_back({block_addr, cycle + config.miss_latency, 0, false});
+    }
+    return {false, false};
+}
+
+cache_fill_t CACHE::fill(const miss_t& miss) {
+    uint32_t set_index = get_set(miss.block_addr);
+    block_t* set = &blocks[set_index * config.ways];
+    std::size_t victim = 0;
+    for (std::size_t way = 0; way < config.ways; ++way) {
+        if (!set[way].valid) {
+            victim = way;
+            break;
+        }
+        if (set[way].last_used < set[victim].last_used)
+            victim = way;
+    }
+
+    block_t& block = set[victim];
+    uint64_t evicted_address = block.valid ? block.block_addr << CACHE_LOG2_BLOCK_SIZE : 0;
+    if (block.valid && block.prefetched)
+        usage_of(block.metadata).useless++;
+
+    block = {miss.block_addr, cycle, miss.metadata, true, miss.prefetch};
+    return {miss.block_addr << CACHE_LOG2_BLOCK_SIZE, set_index, static_cast<uint32_t>(victim), miss.prefetch, evicted_address, miss.metadata};
+}
+
+void CACHE::operate(std::vector<cache_fill_t>& fills) {
+    auto due = std::stable_partition(misses.begin(), misses.end(), [this](const miss_t& m) { return m.ready_cycle > cycle; });
+    for (auto it = due; it != misses.end(); ++it)
+        fills.push_back(fill(*it));
+    misses.erase(due, misses.end());
+
+    // Prefetches for blocks already here or on their way are dropped, those for the next level leave this cache
+    if (!pq.empty()) {
+        pq_entry_t entry = pq.front();
+        pq.pop_front();
+        if (entry.fill_this_level && find_block(entry.block_addr) == nullptr && find_miss(entry.block_addr) == nullptr)
+            misses.push_back({entry.block_addr, cycle + config.miss_latency, entry.metadata, true});
+    }
+
+    cycle++;
+    current_time += clock_period;
+}
@@ -0,0 +1,120 @@
+#ifndef MYL1PREF_TEST_CACHE_H
+#define MYL1PREF_TEST_CACHE_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include "modules.h"
+
+// Stand-in for ChampSim's CACHE: set-associative with LRU replacement, a prefetch queue drained
+// one entry per cycle and a fixed miss latency. It records every prefetch it accepts and counts
+// what became of them per prefetch metadata (myl1pref sends the engine id there)
+
+constexpr unsigned CACHE_LOG2_BLOCK_SIZE = 6;
+constexpr std::size_t CACHE_MAX_METADATA = 8; // Metadata values counted separately, larger ones share the last slot
+
+struct cache_model_config_t {
+  std::string name = "cpu0_L1D"; // myl1pref picks its level from the name
+  std::size_t sets = 64;
+  std::size_t ways = 12;
+  std::size_t pq_size = 8;
+  uint64_t miss_latency = 12; // Cycles from the miss (or the prefetch leaving the PQ) to the fill
+  bool virtual_prefetch = false;
+};
+
+struct prefetch_record_t {
+  uint64_t cycle;
+  uint64_t access_index; // Demand accesses seen before this prefetch was sent
+  uint64_t block_addr;
+  bool fill_this_level;
+  uint32_t metadata;
+};
+
+struct prefetch_usage_t {
+  uint64_t issued = 0;       // Accepted to fill this level
+  uint64_t issued_lower = 0; // Accepted to fill the next level only
+  uint64_t useful = 0;       // First demand hit on the prefetched block
+  uint64_t late = 0;         // Demand miss while the prefetch of the block was in flight
+  uint64_t useless = 0;      // Evicted without a demand hit
+};
+
+struct cache_fill_t {
+  uint64_t address;
+  uint32_t set;
+  uint32_t way;
+  bool prefetch;
+  uint64_t evicted_address;
+  uint32_t metadata;
+};
+
+struct demand_result_t {
+  bool hit;
+  bool useful_prefetch;
+};
+
+class CACHE {
+  struct block_t {
+    uint64_t block_addr = 0;
+    uint64_t last_used = 0;
+    uint32_t metadata = 0;
+    bool valid = false;
+    bool prefetched = false; // Filled by a prefetch, no demand hit yet
+  };
+  struct miss_t {
+    uint64_t block_addr;
+    uint64_t ready_cycle;
+    uint32_t metadata;
+    bool prefetch;
+  };
+  struct pq_entry_t {
+    uint64_t block_addr;
+    uint32_t metadata;
+    bool fill_this_level;
+  };
+
+  cache_model_config_t config;
+  std::vector<block_t> blocks; // Set after set, config.ways blocks each
+  std::deque<pq_entry_t> pq;
+  std::vector<miss_t> misses;  // In flight, no MSHR limit
+  uint64_t cycle = 0;
+  uint64_t demand_accesses = 0;
+  uint64_t demand_hits = 0;
+  std::array<prefetch_usage_t, CACHE_MAX_METADATA> usage{};
+  std::vector<prefetch_record_t> prefetches;
+  bool record_prefetches = false;
+
+  uint32_t get_set(uint64_t block_addr) const { return static_cast<uint32_t>(block_addr % config.sets); }
+  block_t* find_block(uint64_t block_addr);
+  miss_t* find_miss(uint64_t block_addr);
+  prefetch_usage_t& usage_of(uint32_t metadata) { return usage[std::min<std::size_t>(metadata, CACHE_MAX_METADATA - 1)]; }
+  cache_fill_t fill(const miss_t& miss);
+
+public:
+  // ChampSim interface used by the prefetchers
+  std::string NAME;
+  bool virtual_prefetch;
+  std::chrono::time_point<std::chrono::steady_clock, std::chrono::nanoseconds> current_time{};
+  std::chrono::nanoseconds clock_period{1};
+
+  explicit CACHE(const cache_model_config_t& model_config, bool record = false);
+
+  std::vector<std::size_t> get_pq_occupancy() const { return {pq.size()}; }
+  std::vector<std::size_t> get_pq_size() const { return {config.pq_size}; }
+  bool prefetch_line(champsim::address pf_addr, bool fill_this_level, uint32_t prefetch_metadata);
+
+  // Model, driven by the replay: a demand load, then one cycle (due fills, PQ head sent, clock)
+  demand_result_t demand_access(uint64_t address);
+  void operate(std::vector<cache_fill_t>& fills);
+
+  uint64_t get_cycle() const { return cycle; }
+  uint64_t get_demand_accesses() const { return demand_accesses; }
+  uint64_t get_demand_hits() const { return demand_hits; }
+  const std::array<prefetch_usage_t, CACHE_MAX_METADATA>& get_usage() const { return usage; }
+  const std::vector<prefetch_record_t>& get_prefetches() const { return prefetches; }
+};
+
+#endif
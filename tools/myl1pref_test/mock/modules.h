@@ -0,0 +1,38 @@
+#ifndef MYL1PREF_TEST_MODULES_H
+#define MYL1PREF_TEST_MODULES_H
+
+#include <cstdint>
+
+// Stand-in for ChampSim's modules.h, with only what the modules of this repo use
+
+namespace champsim {
+class address {
+  uint64_t value = 0;
+
+public:
+  address() = default;
+  explicit address(uint64_t v) : value(v) {}
+
+  template <typename T>
+  T to() const { return static_cast<T>(value); }
+};
+} // namespace champsim
+
+enum class access_type : unsigned { LOAD = 0, RFO, PREFETCH, WRITE, TRANSLATION };
+
+class CACHE;
+class O3_CPU;
+
+namespace champsim::modules {
+struct prefetcher {
+  CACHE* intern_;
+  explicit prefetcher(CACHE* cache) : intern_(cache) {}
+};
+
+struct branch_predictor {
+  O3_CPU* intern_;
+  explicit branch_predictor(O3_CPU* cpu) : intern_(cpu) {}
+};
+} // namespace champsim::modules
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef MYL1PREF_TEST_MSL_FWCOUNTER_H
+#define MYL1PREF_TEST_MSL_FWCOUNTER_H
+
+#include <algorithm>
+#include <cstddef>
+
+// Stand-in for ChampSim's msl/fwcounter.h: a WIDTH bit counter that saturates at both ends
+
+namespace champsim::msl {
+template <std::size_t WIDTH>
+class fwcounter {
+  int count = 0;
+
+public:
+  static constexpr int minimum = 0;
+  static constexpr int maximum = (1 << WIDTH) - 1;
+
+  fwcounter() = default;
+  explicit fwcounter(int value) : count(std::clamp(value, minimum, maximum)) {}
+
+  int value() const { return count; }
+  fwcounter& operator+=(int delta) {
+    count = std::clamp(count + delta, minimum, maximum);
+    return *this;
+  }
+  fwcounter& operator-=(int delta) { return *this += -delta; }
+};
+} // namespace champsim::msl
+
+#endif
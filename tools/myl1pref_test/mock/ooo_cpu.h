@@ -0,0 +1,13 @@
+#ifndef MYL1PREF_TEST_OOO_CPU_H
+#define MYL1PREF_TEST_OOO_CPU_H
+
+#include <cstdint>
+#include "modules.h"
+
+// Stand-in for ChampSim's O3_CPU: the branch predictor only needs the core number
+class O3_CPU {
+public:
+  uint32_t cpu = 0;
+};
+
+#endif
@@ -0,0 +1,191 @@
+// Feeds small hand-made load streams to myl1pref and checks the exact prefetches each engine sends.
+//   myl1pref_engine_test <nl|dht|rp|tc|bg>
+// Loads are far apart (50 cycles, 20 cycle misses), so every candidate reaches the PQ before the next load.
+// bg is skipped (exit code 77) when built with BRANCH_HINT_CHANNEL=0
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "replay.h"
+
+namespace {
+constexpr uint64_t PAGE_BLOCKS = 1 << (LOG2_PAGE_SIZE - LOG2_CACHE_LINE_SIZE);
+
+// Load that triggered the prefetch (index in the stream) and prefetched block
+using issued_list_t = std::vector<std::pair<uint64_t, uint64_t>>;
+
+replay_config_t test_config(const char* cache_name) {
+    replay_config_t config;
+    config.cache.name = cache_name;
+    config.access_interval = 50;
+    config.record_prefetches = true;
+    return config;
+}
+
+issued_list_t issued_by(const replay_session& session, PrefetchSourceEngine engine) {
+    issued_list_t issued;
+    for (const prefetch_record_t& p : session.get_cache().get_prefetches())
+        if (p.metadata == static_cast<uint32_t>(engine))
+            issued.emplace_back(p.access_index - 1, p.block_addr);
+    return issued;
+}
+
+bool expect_issued(const std::string& what, const issued_list_t& issued, const issued_list_t& expected) {
+    if (issued == expected)
+        return true;
+    auto print = [](const issued_list_t& list) {
+        for (const auto& [load, block] : list)
+            std::cerr << " " << load << ":0x" << std::hex << block << std::dec;
+        std::cerr << "\n";
+    };
+    std::cerr << "FAIL " << what << "\n  expected (load:block):";
+    print(expected);
+    std::cerr << "  issued:               ";
+    print(issued);
+    return false;
+}
+
+uint64_t block_address(uint64_t block) { return block << LOG2_CACHE_LINE_SIZE; }
+
+// Isolated loads, 16MB apart: only NL has something to say, the next line. Not across pages unless virtual
+bool test_nl() {
+    bool ok = true;
+    for (bool virtual_prefetch : {false, true}) {
+        replay_config_t config = test_config("cpu0_L1D");
+        config.cache.virtual_prefetch = virtual_prefetch;
+        replay_session session(config);
+
+        std::vector<uint64_t> blocks;
+        for (uint64_t i = 0; i < 16; ++i)
+            blocks.push_back((i + 1) * (4096 * PAGE_BLOCKS) + (i * 5) % (PAGE_BLOCKS - 1));
+        blocks.push_back(17 * (4096 * PAGE_BLOCKS) + PAGE_BLOCKS - 1); // Last line of its page
+
+        issued_list_t expected;
+        for (uint64_t i = 0; i < blocks.size(); ++i) {
+            session.load(0x401000, block_address(blocks[i]));
+            if (virtual_prefetch || (blocks[i] + 1) % PAGE_BLOCKS != 0)
+                expected.emplace_back(i, blocks[i] + 1);
+        }
+        session.finish();
+
+        std::string what = virtual_prefetch ? "nl (virtual)" : "nl";
+        ok &= expect_issued(what, issued_by(session, PrefetchSourceEngine::NL), expected);
+        for (auto engine : {PrefetchSourceEngine::DHT, PrefetchSourceEngine::RP, PrefetchSourceEngine::TC, PrefetchSourceEngine::BG})
+            ok &= expect_issued(what + ", nothing from " + engine_traits::names[engine], issued_by(session, engine), {});
+    }
+    return ok;
+}
+
+// One PC, stride 40 blocks (past the RP region and the next line). PHT 1 learns the stride with the
+// second delta and is confident (2) after the third, so DHT prefetches one stride ahead from the fourth load
+bool test_dht() {
+    replay_config_t config = test_config("cpu0_L1D");
+    config.cache.virtual_prefetch = true; // The stride crosses pages
+    replay_session session(config);
+
+    constexpr uint64_t STRIDE = 40;
+    uint64_t base = 1 << 24;
+    issued_list_t expected;
+    for (uint64_t i = 0; i < 32; ++i) {
+        session.load(0x402000, block_address(base + i * STRIDE));
+        if (i >= 3)
+            expected.emplace_back(i, base + (i + 1) * STRIDE);
+    }
+    session.finish();
+    return expect_issued("dht", issued_by(session, PrefetchSourceEngine::DHT), expected);
+}
+
+// Regions of the same RP set, each touched at offsets 0, 5, 9 and 17 by a different PC per offset.
+// The third region evicts the first one, whose footprint is recorded for (PC, offset 0): from then on
+// the trigger load of a region prefetches the rest of the footprint. The per-PC deltas cross pages, so DHT stays quiet
+bool test_rp() {
+    replay_session session(test_config("cpu0_L1D"));
+
+    constexpr uint64_t RP_SETS = 1 << RP_INDEX_BITS;
+    constexpr std::array<uint64_t, 4> FOOTPRINT = {0, 5, 9, 17};
+    issued_list_t expected;
+    uint64_t load = 0;
+    for (uint64_t k = 0; k < 8; ++k) {
+        uint64_t region_base = ((1 << 16) + k * RP_SETS) * RP_LINES_PER_REGION;
+        for (std::size_t f = 0; f < FOOTPRINT.size(); ++f) {
+            session.load(0x403000 + 4 * f, block_address(region_base + FOOTPRINT[f]));
+            if (f == 0 && k >= 2)
+                for (std::size_t g = 1; g < FOOTPRINT.size(); ++g)
+                    expected.emplace_back(load, region_base + FOOTPRINT[g]);
+            load++;
+        }
+    }
+    session.finish();
+    return expect_issued("rp", issued_by(session, PrefetchSourceEngine::RP), expected);
+}
+
+// A list of 16 nodes 4MB apart, walked 3 times through an 8 block cache, so each lap misses again.
+// From the second lap, every node prefetches the two that followed it last time: the first one to fill
+// the L1D, the second one the L2 only. The previous node already sent the first one to the L2, which does
+// not stop it from being prefetched again to fill the L1D
+bool test_tc() {
+    replay_config_t config = test_config("cpu0_L1D");
+    config.cache.sets = 4;
+    config.cache.ways = 2;
+    replay_session session(config);
+
+    constexpr uint64_t NODES = 16;
+    std::vector<uint64_t> nodes;
+    for (uint64_t i = 0; i < NODES; ++i)
+        nodes.push_back(((i * 7) % NODES + 1) * (1 << 16) + i * 3);
+
+    issued_list_t expected;
+    for (uint64_t load = 0; load < 3 * NODES; ++load) {
+        session.load(0x404000, block_address(nodes[load % NODES]));
+        if (load >= NODES) {
+            expected.emplace_back(load, nodes[(load + 1) % NODES]);
+            expected.emplace_back(load, nodes[(load + 2) % NODES]);
+        }
+    }
+    session.finish();
+    return expect_issued("tc", issued_by(session, PrefetchSourceEngine::TC), expected);
+}
+
+// A confident branch, then loads at +3 and +7 blocks: when the branch is predicted again, BG prefetches
+// the same deltas from the load the hint arrives with. The other direction of the branch is another path
+bool test_bg() {
+    replay_session session(test_config("cpu5_L1D"));
+    branch_hint_ring& ring = get_branch_hint_ring(5);
+
+    uint64_t x = 1 << 20, y = 2 << 20, z = 3 << 20;
+    ring.publish({0x405000, true});
+    session.load(0x406000, block_address(x));
+    session.load(0x406004, block_address(x + 3));
+    session.load(0x406008, block_address(x + 7));
+    ring.publish({0x405000, false});
+    session.load(0x40600c, block_address(z));
+    ring.publish({0x405000, true});
+    session.load(0x406010, block_address(y));
+    session.finish();
+
+    return expect_issued("bg", issued_by(session, PrefetchSourceEngine::BG), {{4, y + 3}, {4, y + 7}});
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string engine = argc > 1 ? argv[1] : "";
+    bool ok;
+    if (engine == "nl") ok = test_nl();
+    else if (engine == "dht") ok = test_dht();
+    else if (engine == "rp") ok = test_rp();
+    else if (engine == "tc") ok = test_tc();
+    else if (engine == "bg") {
+        if (!BRANCH_HINT_CHANNEL) {
+            std::cerr << "SKIP bg: built with BRANCH_HINT_CHANNEL=0" << std::endl;
+            return 77; // ctest SKIP_RETURN_CODE
+        }
+        ok = test_bg();
+    }
+    else {
+        std::cerr << "usage: myl1pref_engine_test <nl|dht|rp|tc|bg>" << std::endl;
+        return EXIT_FAILURE;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,278 @@
+// Golden-output regression suite: replays fixed synthetic traces through tage and myl1pref and diffs
+// the prefetch stream of each engine and the tage prediction stream against golden/<case>.txt.
+// A golden file holds per engine the prefetch count, a hash of the whole stream (load, block, level)
+// and its first prefetches in clear, so a diff shows where a change starts; tage gets counts and a hash.
+//   myl1pref_golden_test <case>                      check one case
+//   myl1pref_golden_test --update [case...]          rewrite the golden files (all cases by default)
+//   myl1pref_golden_test --throughput [--update]     compare the host speed with golden/throughput.txt,
+//                                                    fails when a case is slower by more than --tolerance (0.3)
+// Host speed depends on the machine: record the baseline again (Release build) where the suite runs.
+// Cases that need the branch hints are skipped (exit code 77) when built with BRANCH_HINT_CHANNEL=0
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "replay.h"
+
+namespace {
+struct golden_case_t {
+  const char* name;
+  const char* trace;
+  const char* cache;
+  std::size_t records;
+  bool needs_branch_hints; // Its golden output has BG prefetches
+};
+
+constexpr golden_case_t GOLDEN_CASES[] = {
+    {"stream_l1d", "stream", "cpu0_L1D", 20000, false},
+    {"stride_l1d", "stride", "cpu0_L1D", 20000, false},
+    {"pointer_chase_l1d", "pointer_chase", "cpu0_L1D", 20000, false},
+    {"spatial_l1d", "spatial", "cpu0_L1D", 20000, false},
+    {"branchy_l1d", "branchy", "cpu0_L1D", 60000, true}, // tage needs a while before its predictions are HIGH and BG learns
+    {"stride_l2c", "stride", "cpu0_L2C", 20000, false},
+    {"pointer_chase_llc", "pointer_chase", "LLC", 20000, false},
+};
+constexpr uint64_t GOLDEN_SEED = 1;
+constexpr std::size_t GOLDEN_LISTED_PREFETCHES = 16; // Per engine, in clear before the hash takes over
+constexpr int THROUGHPUT_RUNS = 3;                   // Best of
+constexpr int EXIT_SKIPPED = 77;                     // ctest SKIP_RETURN_CODE
+
+const std::string golden_dir = GOLDEN_DIR;
+
+// FNV-1a over 64-bit words
+struct stream_hash {
+  uint64_t value = 0xcbf29ce484222325ULL;
+  void add(uint64_t word) {
+    for (int i = 0; i < 8; ++i) {
+      value ^= (word >> (8 * i)) & 0xFF;
+      value *= 0x100000001b3ULL;
+    }
+  }
+};
+
+std::string hex(uint64_t value) {
+    std::ostringstream out;
+    out << "0x" << std::hex << value;
+    return out.str();
+}
+
+replay_config_t golden_config(const golden_case_t& c) {
+    replay_config_t config;
+    config.cache.name = c.cache;
+    config.record_prefetches = true;
+    config.record_predictions = true;
+    return config;
+}
+
+std::vector<std::string> run_case(const golden_case_t& c) {
+    trace_t trace = make_trace(c.trace, c.records, GOLDEN_SEED);
+    auto session = std::make_unique<replay_session>(golden_config(c));
+    for (const trace_record_t& record : trace)
+        session->replay(record);
+    session->finish();
+    replay_stats_t stats = session->get_stats();
+
+    std::vector<std::string> lines;
+    lines.push_back(std::string("# ") + c.name + ": trace " + c.trace + ", " + std::to_string(c.records) + " records, seed " +
+                    std::to_string(GOLDEN_SEED) + ", cache " + c.cache);
+    lines.push_back("loads " + std::to_string(stats.accesses) + " hits " + std::to_string(stats.hits));
+
+    const auto& prefetches = session->get_cache().get_prefetches();
+    for (std::size_t id = 1; id < NUM_PREFETCH_SOURCES; ++id) {
+        std::vector<std::string> listed;
+        stream_hash hash;
+        uint64_t issued = 0;
+        for (const prefetch_record_t& p : prefetches) {
+            if (p.metadata != id)
+                continue;
+            issued++;
+            hash.add(p.access_index);
+            hash.add(p.block_addr);
+            hash.add(p.fill_this_level);
+            if (listed.size() < GOLDEN_LISTED_PREFETCHES)
+                listed.push_back(std::string(engine_traits::names[id]) + " " + std::to_string(p.access_index) + " " + hex(p.block_addr) +
+                                 (p.fill_this_level ? " this" : " lower"));
+        }
+        lines.push_back(std::string(engine_traits::names[id]) + " issued " + std::to_string(issued) + " hash " + hex(hash.value));
+        lines.insert(lines.end(), listed.begin(), listed.end());
+    }
+
+    stream_hash hash;
+    uint64_t mispredicted = 0;
+    for (const prediction_record_t& p : session->get_predictions()) {
+        hash.add(p.ip);
+        hash.add(p.prediction);
+        hash.add(static_cast<uint64_t>(p.confidence));
+        mispredicted += p.prediction != p.taken;
+    }
+    lines.push_back("tage branches " + std::to_string(session->get_predictions().size()) + " mispredicted " + std::to_string(mispredicted) +
+                    " hash " + hex(hash.value));
+    static const char* const level_names[] = {"high", "medium", "low"};
+    std::string levels = "tage";
+    for (std::size_t level = 0; level < stats.branches.size(); ++level)
+        levels += std::string(" ") + level_names[level] + " " + std::to_string(stats.mispredictions[level]) + "/" + std::to_string(stats.branches[level]);
+    lines.push_back(levels);
+    return lines;
+}
+
+bool skipped(const golden_case_t& c) {
+    if (BRANCH_HINT_CHANNEL || !c.needs_branch_hints)
+        return false;
+    std::cerr << "SKIP " << c.name << ": needs the branch hints, built with BRANCH_HINT_CHANNEL=0" << std::endl;
+    return true;
+}
+
+const golden_case_t* find_case(const std::string& name) {
+    for (const golden_case_t& c : GOLDEN_CASES)
+        if (name == c.name)
+            return &c;
+    std::cerr << "myl1pref_golden_test: unknown case " << name << std::endl;
+    return nullptr;
+}
+
+std::vector<std::string> read_lines(const std::string& file_name) {
+    std::vector<std::string> lines;
+    std::ifstream file(file_name);
+    for (std::string line; std::getline(file, line);)
+        lines.push_back(line);
+    return lines;
+}
+
+bool write_lines(const std::string& file_name, const std::vector<std::string>& lines) {
+    std::ofstream file(file_name);
+    for (const std::string& line : lines)
+        file << line << "\n";
+    return static_cast<bool>(file);
+}
+
+bool check_case(const golden_case_t& c) {
+    std::string file_name = golden_dir + "/" + c.name + ".txt";
+    std::vector<std::string> golden = read_lines(file_name);
+    if (golden.empty()) {
+        std::cerr << "FAIL " << c.name << ": no golden output in " << file_name << std::endl;
+        return false;
+    }
+    std::vector<std::string> lines = run_case(c);
+    if (lines == golden)
+        return true;
+
+    std::cerr << "FAIL " << c.name << ": output differs from " << file_name << " (-golden +now)\n";
+    for (std::size_t i = 0; i < std::max(lines.size(), golden.size()); ++i) {
+        const std::string* was = i < golden.size() ? &golden[i] : nullptr;
+        const std::string* now = i < lines.size() ? &lines[i] : nullptr;
+        if (was && now && *was == *now)
+            continue;
+        if (was)
+            std::cerr << "-" << *was << "\n";
+        if (now)
+            std::cerr << "+" << *now << "\n";
+    }
+    std::cerr << "If the change is intended: myl1pref_golden_test --update " << c.name << std::endl;
+    return false;
+}
+
+double measure_throughput(const golden_case_t& c) {
+    trace_t trace = make_trace(c.trace, c.records * 10, GOLDEN_SEED);
+    replay_config_t config;
+    config.cache.name = c.cache;
+    double best = 0;
+    for (int run = 0; run < THROUGHPUT_RUNS; ++run) {
+        replay_stats_t stats = replay_trace(trace, config);
+        best = std::max(best, trace.size() / stats.host_seconds);
+    }
+    return best;
+}
+
+// Baseline: one "<case> <records per second>" line per case
+bool check_throughput(bool update, double tolerance) {
+    std::string file_name = golden_dir + "/throughput.txt";
+    std::map<std::string, double> baseline;
+    for (const std::string& line : read_lines(file_name)) {
+        std::istringstream fields(line);
+        std::string name;
+        double speed;
+        if (fields >> name >> speed)
+            baseline[name] = speed;
+    }
+
+    bool ok = true;
+    std::vector<std::string> lines;
+    for (const golden_case_t& c : GOLDEN_CASES) {
+        double speed = measure_throughput(c);
+        lines.push_back(std::string(c.name) + " " + std::to_string(static_cast<uint64_t>(speed)));
+        std::cout << std::left << std::setw(20) << c.name << std::right << std::fixed << std::setprecision(2) << std::setw(8)
+                  << speed / 1e6 << "M records/s";
+        auto it = baseline.find(c.name);
+        if (it != baseline.end()) {
+            double change = speed / it->second - 1;
+            std::cout << "  " << std::showpos << change * 100 << std::noshowpos << "% vs baseline";
+            if (!update && change < -tolerance) {
+                std::cout << "  SLOWER";
+                ok = false;
+            }
+        } else if (!update) {
+            std::cout << "  no baseline";
+            ok = false;
+        }
+        std::cout << std::endl;
+    }
+    if (update)
+        return write_lines(file_name, lines);
+    return ok;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    bool update = false, throughput = false;
+    double tolerance = 0.3;
+    std::vector<const golden_case_t*> cases;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--update")
+            update = true;
+        else if (arg == "--throughput")
+            throughput = true;
+        else if (arg == "--tolerance" && i + 1 < argc)
+            tolerance = std::stod(argv[++i]);
+        else if (const golden_case_t* c = find_case(arg))
+            cases.push_back(c);
+        else
+            return EXIT_FAILURE;
+    }
+
+    if (throughput)
+        return check_throughput(update, tolerance) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    if (update) {
+        if (cases.empty())
+            for (const golden_case_t& c : GOLDEN_CASES)
+                cases.push_back(&c);
+        for (const golden_case_t* c : cases)
+            if (!skipped(*c) && !write_lines(golden_dir + "/" + c->name + ".txt", run_case(*c)))
+                return EXIT_FAILURE;
+        return EXIT_SUCCESS;
+    }
+
+    if (cases.empty()) {
+        std::cerr << "usage: myl1pref_golden_test <case> | --update [case...] | --throughput [--update] [--tolerance F]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    bool ok = true;
+    std::size_t checked = 0;
+    for (const golden_case_t* c : cases) {
+        if (skipped(*c))
+            continue;
+        ok &= check_case(*c);
+        checked++;
+    }
+    if (ok && checked == 0)
+        return EXIT_SKIPPED;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,59 @@
+// Replays traces through tage and a cache model with myl1pref. Reports coverage, accuracy and
+// timeliness per engine, tage mispredictions per confidence level, and the host speed.
+//   myl1pref_replay [options] [trace...]   (all the synthetic traces by default)
+//   --records N    length of the synthetic traces      --seed N     seed of the synthetic traces
+//   --cache NAME   cache name, picks the level config  --sets N  --ways N  --pq N  --latency N
+//   --interval N   cycles before each load             --virtual    prefetch virtual addresses
+//   --stats        print the prefetcher final stats (telemetry) after each trace
+
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "replay.h"
+
+int main(int argc, char** argv) {
+    replay_config_t config;
+    std::size_t records = 1000000;
+    uint64_t seed = 1;
+    std::vector<std::string> traces;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "myl1pref_replay: " << arg << " needs a value" << std::endl;
+                std::exit(EXIT_FAILURE);
+            }
+            return argv[++i];
+        };
+        if (arg == "--records") records = std::stoull(value());
+        else if (arg == "--seed") seed = std::stoull(value());
+        else if (arg == "--cache") config.cache.name = value();
+        else if (arg == "--sets") config.cache.sets = std::stoull(value());
+        else if (arg == "--ways") config.cache.ways = std::stoull(value());
+        else if (arg == "--pq") config.cache.pq_size = std::stoull(value());
+        else if (arg == "--latency") config.cache.miss_latency = std::stoull(value());
+        else if (arg == "--interval") config.access_interval = std::stoull(value());
+        else if (arg == "--virtual") config.cache.virtual_prefetch = true;
+        else if (arg == "--stats") config.final_stats = true;
+        else if (arg.rfind("--", 0) == 0) {
+            std::cerr << "myl1pref_replay: unknown option " << arg << std::endl;
+            return EXIT_FAILURE;
+        } else traces.push_back(arg);
+    }
+    if (traces.empty())
+        traces.assign(SYNTHETIC_TRACE_NAMES.begin(), SYNTHETIC_TRACE_NAMES.end());
+
+    try {
+        for (const std::string& name : traces) {
+            trace_t trace = make_trace(name, records, seed);
+            print_replay_report(std::cout, name, replay_trace(trace, config));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "myl1pref_replay: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
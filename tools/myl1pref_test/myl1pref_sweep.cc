@@ -0,0 +1,322 @@
+// Sweeps a grid of myl1pref knobs and cache parameters over a set of traces on all the host cores and
+// prints one merged CSV table, one row per (trace, grid point), in grid order whatever the finishing order.
+//   myl1pref_sweep [options] [trace...]   (all the synthetic traces by default)
+//   --records N  --seed N                 synthetic traces, as in myl1pref_replay
+//   --level L1D,L2C,LLC                   cache levels, each with the default myl1pref knobs of the level
+//   --aht-bits LIST  --pht-bits LIST  --rp-bits LIST  --rp-pht-bits LIST  --tc-history-bits LIST
+//   --tc-index-bits LIST                  myl1pref table sizes (log2 of the entries, level_config_t)
+//   --explore LIST  --exploit LIST  --aging LIST    myl1pref phase and aging durations, in cycles
+//   --sets LIST  --ways LIST  --pq LIST  --latency LIST  --interval LIST  --virtual 0,1    cache and replay
+//   --jobs N                              worker threads (host cores by default)
+// Every list is comma separated, the grid is their cross product; parameters not given keep their default.
+// The tage knobs are not swept: its tables are sized by constants and its history lengths are fixed in init().
+// Each worker replays as its own core (cpu<worker>_<level>) since the branch hint rings are per core.
+// Traces are decoded once, by the first job that needs them, and shared by all the others
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "branch_hints.h"
+#include "replay.h"
+
+namespace {
+std::vector<std::string> split(const std::string& list) {
+    std::vector<std::string> items;
+    std::istringstream in(list);
+    for (std::string item; std::getline(in, item, ',');)
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+std::vector<uint64_t> split_numbers(const std::string& list) {
+    std::vector<uint64_t> numbers;
+    for (const std::string& item : split(list))
+        numbers.push_back(std::stoull(item));
+    return numbers;
+}
+
+// Decoded traces, shared by the jobs. A trace is decoded outside the lock, by the first job asking for it
+class trace_cache {
+  struct entry_t {
+    std::once_flag decoded;
+    std::shared_ptr<const trace_t> trace;
+  };
+  std::vector<std::string> names;
+  std::size_t records;
+  uint64_t seed;
+  std::deque<entry_t> entries; // Not a vector: once_flag does not move
+
+public:
+  trace_cache(const std::vector<std::string>& trace_names, std::size_t synthetic_records, uint64_t synthetic_seed)
+      : names(trace_names), records(synthetic_records), seed(synthetic_seed), entries(trace_names.size()) {}
+
+  // Throws what make_trace() throws; the next caller tries again
+  std::shared_ptr<const trace_t> get(std::size_t index) {
+    entry_t& entry = entries[index];
+    std::call_once(entry.decoded, [&] { entry.trace = std::make_shared<const trace_t>(make_trace(names[index], records, seed)); });
+    return entry.trace;
+  }
+};
+
+// Work stealing: each worker starts with a contiguous share of the jobs, takes from the front of its own
+// queue and, once it is empty, from the back of the others. No job is added after the start
+class sweep_pool {
+  struct worker_queue {
+    std::mutex mutex;
+    std::deque<std::size_t> jobs;
+  };
+  std::deque<worker_queue> queues;
+
+  bool next_job(std::size_t worker, std::size_t& job) {
+    for (std::size_t i = 0; i < queues.size(); ++i) {
+      worker_queue& queue = queues[(worker + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.jobs.empty())
+        continue;
+      if (i == 0) {
+        job = queue.jobs.front();
+        queue.jobs.pop_front();
+      } else {
+        job = queue.jobs.back();
+        queue.jobs.pop_back();
+      }
+      return true;
+    }
+    return false;
+  }
+
+public:
+  explicit sweep_pool(std::size_t workers) : queues(workers) {}
+
+  template <typename F>
+  void run(std::size_t jobs, F&& job_function) {
+    for (std::size_t job = 0; job < jobs; ++job)
+      queues[job * queues.size() / jobs].jobs.push_back(job);
+
+    std::vector<std::thread> threads;
+    for (std::size_t worker = 0; worker < queues.size(); ++worker)
+      threads.emplace_back([this, worker, &job_function] {
+        for (std::size_t job; next_job(worker, job);)
+          job_function(worker, job);
+      });
+    for (std::thread& thread : threads)
+      thread.join();
+  }
+};
+
+// A grid axis. Cache and replay axes set the replay config, myl1pref axes change the knobs of the level
+struct sweep_axis_t {
+  const char* option;
+  uint64_t min_value;
+  uint64_t max_value;
+  void (*apply_config)(replay_config_t&, uint64_t);
+  void (*apply_tuning)(myl1pref_tuning_t&, uint64_t);
+};
+
+constexpr uint64_t MAX_INDEX_BITS = 24; // Tables of 16M entries
+constexpr uint64_t NO_MAX = UINT64_MAX;
+
+const sweep_axis_t SWEEP_AXES[] = {
+    {"--aht-bits", 1, MAX_INDEX_BITS, nullptr, [](myl1pref_tuning_t& t, uint64_t v) { t.level_config.aht_index_bits = static_cast<unsigned>(v); }},
+    {"--pht-bits", 1, MAX_INDEX_BITS, nullptr, [](myl1pref_tuning_t& t, uint64_t v) { t.level_config.pht_index_bits = static_cast<unsigned>(v); }},
+    {"--rp-bits", 1, MAX_INDEX_BITS, nullptr, [](myl1pref_tuning_t& t, uint64_t v) { t.level_config.rp_index_bits = static_cast<unsigned>(v); }},
+    {"--rp-pht-bits", 1, MAX_INDEX_BITS, nullptr, [](myl1pref_tuning_t& t, uint64_t v) { t.level_config.rp_pht_index_bits = static_cast<unsigned>(v); }},
+    {"--tc-history-bits", 1, MAX_INDEX_BITS, nullptr, [](myl1pref_tuning_t& t, uint64_t v) { t.level_config.tc_history_bits = static_cast<unsigned>(v); }},
+    {"--tc-index-bits", 1, MAX_INDEX_BITS, nullptr, [](myl1pref_tuning_t& t, uint64_t v) { t.level_config.tc_index_bits = static_cast<unsigned>(v); }},
+    {"--explore", 1, NO_MAX, nullptr, [](myl1pref_tuning_t& t, uint64_t v) { t.explore_duration_cycles = v; }},
+    {"--exploit", 1, NO_MAX, nullptr, [](myl1pref_tuning_t& t, uint64_t v) { t.exploit_duration_cycles = v; }},
+    {"--aging", 1, NO_MAX, nullptr, [](myl1pref_tuning_t& t, uint64_t v) { t.aging_interval_cycles = v; }},
+    {"--sets", 1, NO_MAX, [](replay_config_t& c, uint64_t v) { c.cache.sets = v; }, nullptr},
+    {"--ways", 1, NO_MAX, [](replay_config_t& c, uint64_t v) { c.cache.ways = v; }, nullptr},
+    {"--pq", 1, NO_MAX, [](replay_config_t& c, uint64_t v) { c.cache.pq_size = v; }, nullptr},
+    {"--latency", 0, NO_MAX, [](replay_config_t& c, uint64_t v) { c.cache.miss_latency = v; }, nullptr},
+    {"--interval", 0, NO_MAX, [](replay_config_t& c, uint64_t v) { c.access_interval = v; }, nullptr},
+    {"--virtual", 0, 1, [](replay_config_t& c, uint64_t v) { c.cache.virtual_prefetch = v != 0; }, nullptr},
+};
+
+using sweep_grid_t = std::vector<std::pair<const sweep_axis_t*, std::vector<uint64_t>>>; // The axes given and their values
+
+// Next point of the grid, the last axis varying fastest. False after the last one
+bool next_point(std::vector<std::size_t>& point, const sweep_grid_t& grid) {
+    for (std::size_t k = grid.size(); k > 0; --k) {
+        if (++point[k - 1] < grid[k - 1].second.size())
+            return true;
+        point[k - 1] = 0;
+    }
+    return false;
+}
+
+struct sweep_job_t {
+  std::size_t trace;
+  std::string level;
+  replay_config_t config; // Cache name set by the worker running it
+};
+
+struct sweep_result_t {
+  replay_stats_t stats;
+  std::string error;
+};
+
+void print_header(std::ostream& out) {
+    out << "trace,level,aht_bits,pht_bits,rp_bits,rp_pht_bits,tc_history_bits,tc_index_bits,explore,exploit,aging,"
+           "sets,ways,pq,latency,interval,virtual,accesses,misses,coverage,accuracy";
+    for (std::size_t id = 1; id < NUM_PREFETCH_SOURCES; ++id)
+        for (const char* column : {"issued", "lower", "useful", "late", "useless"})
+            out << "," << engine_traits::names[id] << "_" << column;
+    out << ",branches,mispredicted,host_seconds\n";
+}
+
+// Coverage and accuracy over all the engines, defined as in print_replay_report()
+void print_row(std::ostream& out, const std::string& trace_name, const sweep_job_t& job, const replay_stats_t& stats) {
+    auto ratio = [](uint64_t n, uint64_t d) { return d > 0 ? static_cast<double>(n) / static_cast<double>(d) : 0.0; };
+    prefetch_usage_t total;
+    for (const prefetch_usage_t& usage : stats.engines) {
+        total.issued += usage.issued;
+        total.useful += usage.useful;
+        total.late += usage.late;
+    }
+    uint64_t branches = 0, mispredicted = 0;
+    for (std::size_t level = 0; level < stats.branches.size(); ++level) {
+        branches += stats.branches[level];
+        mispredicted += stats.mispredictions[level];
+    }
+
+    const level_config_t& level_config = stats.tuning.level_config;
+    const cache_model_config_t& cache = job.config.cache;
+    out << trace_name << "," << job.level << "," << level_config.aht_index_bits << "," << level_config.pht_index_bits << ","
+        << level_config.rp_index_bits << "," << level_config.rp_pht_index_bits << "," << level_config.tc_history_bits << ","
+        << level_config.tc_index_bits << "," << stats.tuning.explore_duration_cycles << "," << stats.tuning.exploit_duration_cycles << ","
+        << stats.tuning.aging_interval_cycles << "," << cache.sets << "," << cache.ways << "," << cache.pq_size << ","
+        << cache.miss_latency << "," << job.config.access_interval << "," << cache.virtual_prefetch << ","
+        << stats.accesses << "," << stats.misses() << "," << ratio(total.useful, stats.misses() + total.useful) << ","
+        << ratio(total.useful + total.late, total.issued);
+    for (std::size_t id = 1; id < NUM_PREFETCH_SOURCES; ++id) {
+        const prefetch_usage_t& usage = stats.engines[id];
+        out << "," << usage.issued << "," << usage.issued_lower << "," << usage.useful << "," << usage.late << "," << usage.useless;
+    }
+    out << "," << branches << "," << mispredicted << "," << stats.host_seconds << "\n";
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    std::size_t records = 1000000;
+    uint64_t seed = 1;
+    std::vector<std::string> traces, levels = {"L1D"};
+    sweep_grid_t grid;
+    std::size_t workers = std::max(1u, std::thread::hardware_concurrency());
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) {
+                    std::cerr << "myl1pref_sweep: " << arg << " needs a value" << std::endl;
+                    std::exit(EXIT_FAILURE);
+                }
+                return argv[++i];
+            };
+            auto axis = std::find_if(std::begin(SWEEP_AXES), std::end(SWEEP_AXES), [&arg](const sweep_axis_t& a) { return arg == a.option; });
+            if (axis != std::end(SWEEP_AXES)) {
+                std::vector<uint64_t> values = split_numbers(value());
+                if (values.empty()) {
+                    std::cerr << "myl1pref_sweep: " << arg << " needs a value" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                for (uint64_t v : values)
+                    if (v < axis->min_value || v > axis->max_value) {
+                        std::cerr << "myl1pref_sweep: " << arg << " " << v << " out of range [" << axis->min_value << ", " << axis->max_value << "]" << std::endl;
+                        return EXIT_FAILURE;
+                    }
+                auto given = std::find_if(grid.begin(), grid.end(), [&axis](const auto& g) { return g.first == &*axis; });
+                if (given != grid.end())
+                    given->second = values;
+                else
+                    grid.emplace_back(&*axis, values);
+            } else if (arg == "--records") records = std::stoull(value());
+            else if (arg == "--seed") seed = std::stoull(value());
+            else if (arg == "--level") levels = split(value());
+            else if (arg == "--jobs") workers = std::stoull(value());
+            else if (arg.rfind("--", 0) == 0) {
+                std::cerr << "myl1pref_sweep: unknown option " << arg << std::endl;
+                return EXIT_FAILURE;
+            } else traces.push_back(arg);
+        }
+    } catch (const std::exception&) {
+        std::cerr << "myl1pref_sweep: bad number in the options" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (traces.empty())
+        traces.assign(SYNTHETIC_TRACE_NAMES.begin(), SYNTHETIC_TRACE_NAMES.end());
+    for (const std::string& level : levels)
+        if (level != "L1D" && level != "L2C" && level != "LLC") {
+            std::cerr << "myl1pref_sweep: unknown level " << level << ", use L1D, L2C or LLC" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+    // Axes in SWEEP_AXES order, whatever the order of the options
+    std::sort(grid.begin(), grid.end(), [](const auto& x, const auto& y) { return x.first < y.first; });
+
+    // Trace major, so the jobs of a worker mostly share their trace
+    std::vector<sweep_job_t> jobs;
+    for (std::size_t trace = 0; trace < traces.size(); ++trace)
+        for (const std::string& level : levels) {
+            std::vector<std::size_t> point(grid.size(), 0);
+            for (bool more = true; more; more = next_point(point, grid)) {
+                sweep_job_t job{trace, level, {}};
+                std::vector<std::pair<const sweep_axis_t*, uint64_t>> tuning;
+                for (std::size_t k = 0; k < grid.size(); ++k) {
+                    const sweep_axis_t* axis = grid[k].first;
+                    uint64_t v = grid[k].second[point[k]];
+                    if (axis->apply_config)
+                        axis->apply_config(job.config, v);
+                    else
+                        tuning.emplace_back(axis, v);
+                }
+                job.config.tune = [tuning](myl1pref_tuning_t& t) {
+                    for (const auto& [axis, v] : tuning)
+                        axis->apply_tuning(t, v);
+                };
+                jobs.push_back(job);
+            }
+        }
+
+    // One core per worker: never more workers than hint rings, nor than jobs
+    workers = std::clamp<std::size_t>(workers, 1, std::min<std::size_t>(BRANCH_HINT_MAX_CPUS, std::max<std::size_t>(jobs.size(), 1)));
+    std::cerr << "myl1pref_sweep: " << jobs.size() << " jobs on " << workers << " threads" << std::endl;
+
+    trace_cache cache(traces, records, seed);
+    std::vector<sweep_result_t> results(jobs.size());
+    sweep_pool(workers).run(jobs.size(), [&](std::size_t worker, std::size_t index) {
+        sweep_job_t job = jobs[index];
+        job.config.cache.name = "cpu" + std::to_string(worker) + "_" + job.level;
+        try {
+            results[index].stats = replay_trace(*cache.get(job.trace), job.config);
+        } catch (const std::exception& e) {
+            results[index].error = e.what();
+        }
+    });
+
+    bool ok = true;
+    print_header(std::cout);
+    for (std::size_t index = 0; index < jobs.size(); ++index) {
+        if (!results[index].error.empty()) {
+            std::cerr << "myl1pref_sweep: " << traces[jobs[index].trace] << ": " << results[index].error << std::endl;
+            ok = false;
+            continue;
+        }
+        print_row(std::cout, traces[jobs[index].trace], jobs[index], results[index].stats);
+    }
+    std::cout << std::flush;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
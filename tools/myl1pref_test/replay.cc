@@ -0,0 +1,127 @@
+#include "replay.h"
+#include <cctype>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+
+static_assert(NUM_PREFETCH_SOURCES <= CACHE_MAX_METADATA, "The cache model must count every engine id separately");
+
+namespace {
+// Same rule as myl1pref: cpu<N>_..., 0 otherwise
+uint32_t cpu_of(const std::string& cache_name) {
+    if (cache_name.rfind("cpu", 0) != 0)
+        return 0;
+    uint32_t cpu = 0;
+    for (std::size_t i = 3; i < cache_name.size() && std::isdigit(static_cast<unsigned char>(cache_name[i])); ++i)
+        cpu = cpu * 10 + static_cast<uint32_t>(cache_name[i] - '0');
+    return cpu;
+}
+} // namespace
+
+replay_session::replay_session(const replay_config_t& replay_config)
+    : config(replay_config), cache(replay_config.cache, replay_config.record_prefetches), prefetcher(&cache), predictor(&cpu) {
+    cpu.cpu = cpu_of(config.cache.name);
+    // The hint rings are global: hints left by an earlier session of this core must not reach this one
+    branch_hint_t stale;
+    get_branch_hint_ring(cpu.cpu).consume_newest(stale);
+    tuning = prefetcher.default_tuning();
+    if (config.tune)
+        config.tune(tuning);
+    prefetcher.initialize_with(tuning);
+}
+
+// Same order as a ChampSim cycle: fills reach the prefetcher first, then it gets its cycle
+void replay_session::tick() {
+    fills.clear();
+    cache.operate(fills);
+    for (const cache_fill_t& f : fills)
+        prefetcher.prefetcher_cache_fill(champsim::address{f.address}, f.set, f.way, f.prefetch, champsim::address{f.evicted_address}, f.metadata);
+    prefetcher.prefetcher_cycle_operate();
+}
+
+void replay_session::load(uint64_t ip, uint64_t address) {
+    for (uint64_t i = 0; i < config.access_interval; ++i)
+        tick();
+    demand_result_t result = cache.demand_access(address);
+    prefetcher.prefetcher_cache_operate(champsim::address{address}, champsim::address{ip}, result.hit, result.useful_prefetch, access_type::LOAD, 0);
+}
+
+void replay_session::branch(uint64_t ip, bool taken) {
+    bool prediction = predictor.predict_branch(champsim::address{ip});
+    auto confidence = predictor.get_confidence();
+    predictor.last_branch_result(champsim::address{ip}, champsim::address{}, taken, 0);
+
+    branches[static_cast<std::size_t>(confidence)]++;
+    if (prediction != taken)
+        mispredictions[static_cast<std::size_t>(confidence)]++;
+    if (config.record_predictions)
+        predictions.push_back({ip, prediction, taken, confidence});
+}
+
+// One more interval, for the candidates of the last load
+void replay_session::finish() {
+    for (uint64_t i = 0; i < config.access_interval; ++i)
+        tick();
+    if (config.final_stats)
+        prefetcher.prefetcher_final_stats();
+}
+
+replay_stats_t replay_session::get_stats() const {
+    replay_stats_t stats;
+    stats.accesses = cache.get_demand_accesses();
+    stats.hits = cache.get_demand_hits();
+    stats.cycles = cache.get_cycle();
+    std::copy_n(cache.get_usage().begin(), NUM_PREFETCH_SOURCES, stats.engines.begin());
+    stats.branches = branches;
+    stats.mispredictions = mispredictions;
+    stats.tuning = tuning;
+    return stats;
+}
+
+replay_stats_t replay_trace(const trace_t& trace, const replay_config_t& config) {
+    auto session = std::make_unique<replay_session>(config); // tage alone is a few hundred KB
+    auto start = std::chrono::steady_clock::now();
+    for (const trace_record_t& record : trace)
+        session->replay(record);
+    auto end = std::chrono::steady_clock::now();
+    session->finish();
+
+    replay_stats_t stats = session->get_stats();
+    stats.host_seconds = std::chrono::duration<double>(end - start).count();
+    return stats;
+}
+
+// Coverage: misses turned into hits, out of the misses there would be. Accuracy: prefetches demanded
+// in time or late, out of those that filled this level. Timeliness: in time, out of those demanded
+void print_replay_report(std::ostream& out, const std::string& trace_name, const replay_stats_t& stats) {
+    auto ratio = [](uint64_t n, uint64_t d) { return d > 0 ? static_cast<double>(n) / static_cast<double>(d) : 0.0; };
+
+    uint64_t useful_total = 0;
+    for (const prefetch_usage_t& usage : stats.engines)
+        useful_total += usage.useful;
+    uint64_t misses_without_prefetch = stats.misses() + useful_total;
+
+    out << trace_name << ": " << stats.accesses << " accesses, " << stats.misses() << " misses, "
+        << std::fixed << std::setprecision(2) << stats.accesses_per_second() / 1e6 << "M accesses/s\n";
+    out << std::left << std::setw(8) << "engine" << std::right << std::setw(10) << "issued" << std::setw(10) << "lower"
+        << std::setw(10) << "useful" << std::setw(10) << "late" << std::setw(10) << "useless" << std::setw(10) << "coverage"
+        << std::setw(10) << "accuracy" << std::setw(12) << "timeliness" << "\n";
+    for (std::size_t id = 1; id < NUM_PREFETCH_SOURCES; ++id) {
+        const prefetch_usage_t& usage = stats.engines[id];
+        out << std::left << std::setw(8) << engine_traits::names[id] << std::right << std::setw(10) << usage.issued
+            << std::setw(10) << usage.issued_lower << std::setw(10) << usage.useful << std::setw(10) << usage.late
+            << std::setw(10) << usage.useless << std::setw(10) << ratio(usage.useful, misses_without_prefetch)
+            << std::setw(10) << ratio(usage.useful + usage.late, usage.issued)
+            << std::setw(12) << ratio(usage.useful, usage.useful + usage.late) << "\n";
+    }
+
+    static const char* const level_names[] = {"high", "medium", "low"};
+    uint64_t branches = stats.branches[0] + stats.branches[1] + stats.branches[2];
+    if (branches > 0) {
+        out << "tage: " << branches << " branches";
+        for (std::size_t level = 0; level < stats.branches.size(); ++level)
+            out << ", " << level_names[level] << " " << stats.mispredictions[level] << "/" << stats.branches[level];
+        out << " mispredicted\n";
+    }
+    out << std::defaultfloat << std::flush;
+}
@@ -0,0 +1,80 @@
+#ifndef MYL1PREF_TEST_REPLAY_H
+#define MYL1PREF_TEST_REPLAY_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "cache.h"
+#include "myl1pref.h"
+#include "ooo_cpu.h"
+#include "tage.h"
+#include "trace.h"
+
+struct replay_config_t {
+  cache_model_config_t cache;
+  uint64_t access_interval = 4; // Cycles before each load, loads never wait for each other. Branches take none
+  bool record_prefetches = false;
+  bool record_predictions = false;
+  bool final_stats = false;     // Call prefetcher_final_stats() at the end (telemetry output)
+  std::function<void(myl1pref_tuning_t&)> tune; // Changes the myl1pref knobs, from the defaults of the level
+};
+
+struct prediction_record_t {
+  uint64_t ip;
+  bool prediction;
+  bool taken;
+  tage::confidence_level confidence;
+};
+
+struct replay_stats_t {
+  uint64_t accesses = 0;
+  uint64_t hits = 0;
+  uint64_t cycles = 0;
+  double host_seconds = 0;
+  std::array<prefetch_usage_t, NUM_PREFETCH_SOURCES> engines{}; // Indexed by PrefetchSourceEngine
+  std::array<uint64_t, 3> branches{};                            // Indexed by tage::confidence_level
+  std::array<uint64_t, 3> mispredictions{};
+  myl1pref_tuning_t tuning{}; // The myl1pref knobs the replay ran with
+
+  uint64_t misses() const { return accesses - hits; }
+  double accesses_per_second() const { return host_seconds > 0 ? accesses / host_seconds : 0; }
+};
+
+// One core: tage, and a cache with myl1pref. The core number comes from the cache name, as in myl1pref,
+// so the predictor hints reach the prefetcher. Tests drive it record by record, replay_trace() runs a whole trace
+class replay_session {
+  replay_config_t config;
+  CACHE cache;
+  myl1pref prefetcher;
+  O3_CPU cpu;
+  tage predictor;
+  std::vector<cache_fill_t> fills;
+  std::array<uint64_t, 3> branches{};
+  std::array<uint64_t, 3> mispredictions{};
+  std::vector<prediction_record_t> predictions;
+  myl1pref_tuning_t tuning;
+
+  void tick();
+
+public:
+  explicit replay_session(const replay_config_t& replay_config);
+
+  void load(uint64_t ip, uint64_t address);
+  void branch(uint64_t ip, bool taken);
+  void replay(const trace_record_t& record) { record.is_branch ? branch(record.ip, record.taken) : load(record.ip, record.address); }
+  void finish(); // Call before reading the stats
+
+  const CACHE& get_cache() const { return cache; }
+  const std::vector<prediction_record_t>& get_predictions() const { return predictions; }
+  replay_stats_t get_stats() const;
+};
+
+replay_stats_t replay_trace(const trace_t& trace, const replay_config_t& config);
+
+// Coverage, accuracy and timeliness per engine, tage mispredictions per confidence level, and the host speed
+void print_replay_report(std::ostream& out, const std::string& trace_name, const replay_stats_t& stats);
+
+#endif
@@ -0,0 +1,155 @@
+#include "trace.h"
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+constexpr unsigned LOG2_BLOCK_SIZE = 6;
+constexpr uint64_t BLOCKS_PER_MB = (1 << 20) >> LOG2_BLOCK_SIZE;
+
+trace_record_t load(uint64_t ip, uint64_t block) { return {ip, block << LOG2_BLOCK_SIZE, false, false}; }
+trace_record_t branch(uint64_t ip, bool taken) { return {ip, 0, true, taken}; }
+
+// A random 1MB aligned block address in the low 4GB
+uint64_t random_base_block(std::mt19937_64& rng) { return (rng() % 4096) * BLOCKS_PER_MB; }
+
+trace_t make_strided_streams(std::size_t records, uint64_t seed, bool random_strides) {
+    constexpr std::size_t NUM_STREAMS = 4;
+    std::mt19937_64 rng(seed);
+    std::array<uint64_t, NUM_STREAMS> position{};
+    std::array<uint64_t, NUM_STREAMS> stride{};
+    std::array<uint64_t, NUM_STREAMS> end{};
+    for (std::size_t s = 0; s < NUM_STREAMS; ++s) {
+        position[s] = random_base_block(rng);
+        end[s] = position[s] + BLOCKS_PER_MB;
+        stride[s] = random_strides ? 2 + rng() % 8 : 1;
+    }
+
+    trace_t trace;
+    trace.reserve(records);
+    for (std::size_t i = 0; i < records; ++i) {
+        std::size_t s = i % NUM_STREAMS;
+        trace.push_back(load(0x401000 + 0x40 * s, position[s]));
+        position[s] += stride[s];
+        if (position[s] >= end[s]) {
+            position[s] = random_base_block(rng);
+            end[s] = position[s] + BLOCKS_PER_MB;
+        }
+    }
+    return trace;
+}
+} // namespace
+
+trace_t make_stream_trace(std::size_t records, uint64_t seed) { return make_strided_streams(records, seed, false); }
+
+trace_t make_stride_trace(std::size_t records, uint64_t seed) { return make_strided_streams(records, seed, true); }
+
+trace_t make_pointer_chase_trace(std::size_t records, uint64_t seed) {
+    // Larger than the L1D, so every lap misses, but short enough for the TC history of the L1D
+    constexpr std::size_t NUM_NODES = 1024;
+    std::mt19937_64 rng(seed);
+    std::vector<uint64_t> nodes(NUM_NODES);
+    for (auto& node : nodes)
+        node = rng() % (256 * BLOCKS_PER_MB); // 256MB heap
+
+    trace_t trace;
+    trace.reserve(records);
+    for (std::size_t i = 0; i < records; ++i)
+        trace.push_back(load(0x402000, nodes[i % NUM_NODES]));
+    return trace;
+}
+
+trace_t make_spatial_trace(std::size_t records, uint64_t seed) {
+    constexpr std::size_t NUM_LAYOUTS = 4;
+    constexpr uint64_t REGION_BLOCKS = 32;
+    std::mt19937_64 rng(seed);
+
+    // 3 to 8 distinct fields per layout, the first one is the trigger
+    std::array<std::vector<uint64_t>, NUM_LAYOUTS> layouts;
+    for (auto& layout : layouts) {
+        std::size_t fields = 3 + rng() % 6;
+        while (layout.size() < fields) {
+            uint64_t offset = rng() % REGION_BLOCKS;
+            if (std::find(layout.begin(), layout.end(), offset) == layout.end())
+                layout.push_back(offset);
+        }
+    }
+
+    trace_t trace;
+    trace.reserve(records);
+    while (trace.size() < records) {
+        std::size_t l = rng() % NUM_LAYOUTS;
+        uint64_t object = (rng() % (64 * BLOCKS_PER_MB / REGION_BLOCKS)) * REGION_BLOCKS; // 64MB of objects
+        for (std::size_t f = 0; f < layouts[l].size() && trace.size() < records; ++f)
+            trace.push_back(load(0x403000 + 0x100 * l + 0x4 * f, object + layouts[l][f]));
+    }
+    return trace;
+}
+
+// Iteration i: branch A, taken 3 times out of 4, then the loads of object i (fields 0, 3 and 7) if taken,
+// a random hash table bucket (2 lines) if not. Branch B is taken 1 time out of 16 at random and adds a
+// load to a random block. The loop branch closes the iteration and is not taken every 16th time
+trace_t make_branchy_trace(std::size_t records, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    uint64_t objects = random_base_block(rng);
+    uint64_t buckets = random_base_block(rng);
+
+    trace_t trace;
+    trace.reserve(records + 8);
+    for (uint64_t i = 0; trace.size() < records; ++i) {
+        bool a_taken = i % 4 != 3;
+        trace.push_back(branch(0x410000, a_taken));
+        if (a_taken) {
+            uint64_t object = objects + (i % 4096) * 8;
+            trace.push_back(load(0x410010, object));
+            trace.push_back(load(0x410014, object + 3));
+            trace.push_back(load(0x410018, object + 7));
+        } else {
+            uint64_t bucket = buckets + (rng() % 8192) * 2;
+            trace.push_back(load(0x410020, bucket));
+            trace.push_back(load(0x410024, bucket + 1));
+        }
+
+        bool b_taken = rng() % 16 == 0;
+        trace.push_back(branch(0x410040, b_taken));
+        if (b_taken)
+            trace.push_back(load(0x410050, rng() % (256 * BLOCKS_PER_MB)));
+        trace.push_back(branch(0x410080, i % 16 != 15));
+    }
+    trace.resize(records);
+    return trace;
+}
+
+trace_t make_trace(const std::string& name, std::size_t records, uint64_t seed) {
+    if (name == "stream")
+        return make_stream_trace(records, seed);
+    if (name == "stride")
+        return make_stride_trace(records, seed);
+    if (name == "pointer_chase")
+        return make_pointer_chase_trace(records, seed);
+    if (name == "spatial")
+        return make_spatial_trace(records, seed);
+    if (name == "branchy")
+        return make_branchy_trace(records, seed);
+
+    std::ifstream file(name);
+    if (!file)
+        throw std::runtime_error("can not read trace " + name + ", and it is not one of the synthetic traces");
+    trace_t trace;
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        uint64_t ip;
+        std::string target;
+        if (!(fields >> std::hex >> ip >> target))
+            continue;
+        if (target == "T" || target == "N")
+            trace.push_back(branch(ip, target == "T"));
+        else
+            trace.push_back({ip, std::stoull(target, nullptr, 16), false, false});
+    }
+    return trace;
+}
@@ -0,0 +1,39 @@
+#ifndef MYL1PREF_TEST_TRACE_H
+#define MYL1PREF_TEST_TRACE_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Load and branch streams for the replay. Generators are deterministic for a seed on every platform:
+// they only use the raw std::mt19937_64 output, never the std distributions
+
+struct trace_record_t {
+  uint64_t ip;
+  uint64_t address; // Loads only
+  bool is_branch;   // Conditional branch, resolved as taken
+  bool taken;
+};
+
+using trace_t = std::vector<trace_record_t>;
+
+// Sequential streams, a few interleaved, each restarting at a random place after 1MB
+trace_t make_stream_trace(std::size_t records, uint64_t seed);
+// One constant stride (2 to 9 blocks) per PC, several PCs interleaved
+trace_t make_stride_trace(std::size_t records, uint64_t seed);
+// Linked list spread over the heap, walked again and again in the same order
+trace_t make_pointer_chase_trace(std::size_t records, uint64_t seed);
+// Objects of a few layouts: each visit touches the same fields, the trigger PC tells the layout
+trace_t make_spatial_trace(std::size_t records, uint64_t seed);
+// Loop whose branches decide which data the iteration reads: the only one with branches
+trace_t make_branchy_trace(std::size_t records, uint64_t seed);
+
+constexpr std::array<const char*, 5> SYNTHETIC_TRACE_NAMES = {"stream", "stride", "pointer_chase", "spatial", "branchy"};
+
+// A synthetic trace by name, else a trace file, one record per line in hex, # starts a comment:
+// "ip address" for a load, "ip T" or "ip N" for a taken or not taken branch. Files are read whole,
+// records only limits synthetic traces. Throws std::runtime_error if the file can not be read
+trace_t make_trace(const std::string& name, std::size_t records, uint64_t seed);
+
+#endif